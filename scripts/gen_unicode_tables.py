@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Regenerate the Unicode tables in xs.c.
+
+usage: gen_unicode_tables.py CaseFolding.txt PropList.txt xs.c
+
+Simple case folding (the C and S entries of CaseFolding.txt) and the
+White_Space ranges of PropList.txt replace everything between the BEGIN and
+END markers of the generated block in xs.c. Both files must come from the
+same Unicode version, which is recorded in the block.
+"""
+
+import re
+import sys
+
+BEGIN = "/* BEGIN generated Unicode tables, see scripts/gen_unicode_tables.py */\n"
+END = "/* END generated Unicode tables */\n"
+
+
+def ucd_lines(path):
+    """(version, fields) for every data line of a UCD file"""
+    with open(path, encoding="utf-8") as f:
+        text = f.read()
+    m = re.match(r"#\s*\w+-(\d+\.\d+\.\d+)\.txt", text)
+    if not m:
+        sys.exit("%s: no version in the header" % path)
+    rows = []
+    for line in text.splitlines():
+        line = line.split("#", 1)[0].strip()
+        if line:
+            rows.append([field.strip() for field in line.split(";")])
+    return m.group(1), rows
+
+
+def read_folding(path):
+    version, rows = ucd_lines(path)
+    fold = {}
+    for code, status, mapping, *_ in rows:
+        if status in ("C", "S"):
+            fold[int(code, 16)] = int(mapping, 16)
+    return version, fold
+
+
+def read_white_space(path):
+    version, rows = ucd_lines(path)
+    ranges = []
+    for codes, prop, *_ in rows:
+        if prop != "White_Space":
+            continue
+        lo, _, hi = codes.partition("..")
+        ranges.append((int(lo, 16), int(hi or lo, 16)))
+    ranges.sort()
+    merged = []
+    for lo, hi in ranges:
+        if merged and lo <= merged[-1][1] + 1:
+            merged[-1] = (merged[-1][0], max(hi, merged[-1][1]))
+        else:
+            merged.append((lo, hi))
+    return version, merged
+
+
+def c_array(decl, values, per_line, fmt="%d"):
+    out = ["%s = {\n" % decl]
+    for i in range(0, len(values), per_line):
+        out.append("    " + ", ".join(fmt % v for v in values[i:i + per_line]) + ",\n")
+    out.append("};\n")
+    return "".join(out)
+
+
+def fold_tables(fold):
+    """two-stage lookup: 256-code-point blocks, deduplicated, index deltas"""
+    deltas = [0] + sorted({to - cp for cp, to in fold.items()} - {0})
+    index = {d: i for i, d in enumerate(deltas)}
+    nblocks = (max(fold) >> 8) + 1
+    blocks, block_index, stage1 = [], {}, []
+    for b in range(nblocks):
+        block = tuple(index[fold.get(cp, cp) - cp] for cp in range(b << 8, (b + 1) << 8))
+        if block not in block_index:
+            block_index[block] = len(blocks)
+            blocks.append(block)
+        stage1.append(block_index[block])
+    if len(blocks) > 256 or len(deltas) > 256:
+        sys.exit("tables no longer fit in uint8_t indices")
+
+    out = ["#define XS_FOLD_LIMIT 0x%X\n" % (nblocks << 8)]
+    out.append(c_array("static const uint8_t xs_fold_stage1[%d]" % len(stage1), stage1, 16))
+    out.append("static const uint8_t xs_fold_stage2[%d][256] = {\n" % len(blocks))
+    for block in blocks:
+        out.append("    {\n")
+        for i in range(0, 256, 16):
+            out.append("        " + ", ".join("%d" % v for v in block[i:i + 16]) + ",\n")
+        out.append("    },\n")
+    out.append("};\n")
+    out.append(c_array("static const int32_t xs_fold_delta[%d]" % len(deltas), deltas, 8))
+    return "".join(out)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__.strip())
+    fold_version, fold = read_folding(sys.argv[1])
+    space_version, spaces = read_white_space(sys.argv[2])
+    if fold_version != space_version:
+        sys.exit("CaseFolding.txt is %s but PropList.txt is %s" % (fold_version, space_version))
+
+    block = [BEGIN, '#define XS_UNICODE_VERSION "%s"\n' % fold_version]
+    block.append(fold_tables(fold))
+    block.append("static const uint32_t xs_uspace_ranges[%d][2] = {\n" % len(spaces))
+    for lo, hi in spaces:
+        block.append("    {0x%04X, 0x%04X},\n" % (lo, hi))
+    block.append("};\n")
+    block.append(END)
+
+    with open(sys.argv[3], encoding="utf-8") as f:
+        source = f.read()
+    start, end = source.find(BEGIN), source.find(END)
+    if start < 0 or end < start:
+        sys.exit("%s: generated block markers not found" % sys.argv[3])
+    source = source[:start] + "".join(block) + source[end + len(END):]
+    with open(sys.argv[3], "w", encoding="utf-8") as f:
+        f.write(source)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,9 +1,14 @@
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 typedef union {
     /* allow strings up to 15 bytes to stay on the stack
@@ -20,7 +25,13 @@ typedef union {
              */
             space_left : 4,
             /* if it is on heap, set to 1 */
-            is_ptr : 1, flag1 : 1, flag2 : 1, flag3 : 1;
+            is_ptr : 1,
+            /* heap buffer not owned: shared through refcnt or borrowed */
+            flag1 : 1,
+            /* heap buffer read by epoch readers, retired instead of freed */
+            flag2 : 1,
+            /* heap buffer laid out as a gap buffer, see xs_gap_insert */
+            flag3 : 1;
     };
 
     /* heap allocated */
@@ -31,7 +42,13 @@ typedef union {
             /* capacity is always a power of 2 (unsigned)-1 */
             capacity : 6;
         /* the last 4 bits are important flags */
-        int *refcnt;
+        union {
+            int *refcnt;
+            /* gap buffer cursor: bytes before it, then the gap, then the
+             * rest of the string up against the end of the buffer
+             */
+            size_t gap;
+        };
     };
 } xs;
 
@@ -40,35 +57,114 @@ static inline size_t xs_size(const xs *x)
 {
     return xs_is_ptr(x) ? x->size : 15 - x->space_left;
 }
+/* close the gap so the string is contiguous again and leave gap mode */
+static inline char *xs_gap_compact(xs *x)
+{
+    size_t gaplen = ((size_t) 1 << x->capacity) - 1 - x->size;
+    memmove(x->ptr + x->gap, x->ptr + x->gap + gaplen, x->size - x->gap);
+    x->ptr[x->size] = 0;
+    x->flag3 = false;
+    x->refcnt = NULL;
+    return x->ptr;
+}
+
 static inline char *xs_data(const xs *x)
 {
-    return xs_is_ptr(x) ? (char *) x->ptr : (char *) x->data;
+    if (!xs_is_ptr(x))
+        return (char *) x->data;
+    if (x->flag3)
+        return xs_gap_compact((xs *) x);
+    return (char *) x->ptr;
 }
 static inline size_t xs_capacity(const xs *x)
 {
     return xs_is_ptr(x) ? ((size_t) 1 << x->capacity) - 1 : 15;
 }
 
+/* non-owning reference to bytes inside an xs or any other buffer */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} xs_view;
+
+static inline xs_view xs_view_of(const xs *x)
+{
+    return (xs_view){xs_data(x), xs_size(x)};
+}
+
+/* .refcnt belongs to another union member and designating it as well would
+ * override .space_left; everything not named, refcnt included, is zeroed
+ */
 #define xs_literal_empty() \
-    (xs) { .space_left = 15, \
-           .refcnt = NULL }
+    (xs) { .space_left = 15 }
 
-static inline int ilog2(uint32_t n) { return 32 - __builtin_clz(n) - 1; }
+static inline int ilog2(size_t n) { return 64 - __builtin_clzll(n) - 1; }
 
-xs *xs_new(xs *x, const void *p)
+/* copy exactly len bytes, so the input may hold embedded NUL bytes and does
+ * not have to be terminated. The result is always NUL-terminated.
+ */
+xs *xs_new_len(xs *x, const void *p, size_t len)
 {
     *x = xs_literal_empty();
-    size_t len = strlen(p) + 1;
-    if (len > 16) {
-        x->capacity = ilog2(len) + 1;
-        x->size = len - 1;
+    if (len > 15) {
+        x->capacity = ilog2(len + 1) + 1;
+        x->size = len;
         x->is_ptr = true;
         x->ptr = malloc((size_t) 1 << x->capacity);
         memcpy(x->ptr, p, len);
+        x->ptr[len] = 0;
     } else {
         memcpy(x->data, p, len);
-        x->space_left = 15 - (len - 1);
+        x->data[len] = 0;
+        x->space_left = 15 - len;
+    }
+    return x;
+}
+
+xs *xs_new(xs *x, const void *p)
+{
+    return xs_new_len(x, p, strlen(p));
+}
+
+/* deep copy: unlike xs_cpy, the result never shares src's heap buffer */
+xs *xs_new_from_xs(xs *x, const xs *src)
+{
+    return xs_new_len(x, xs_data(src), xs_size(src));
+}
+
+/* smallest power of 2 holding len bytes and the terminator: a buffer of
+ * this size is adopted by xs_new_adopt as it is
+ */
+static inline size_t xs_alloc_size(size_t len)
+{
+    return (size_t) 1 << (ilog2(len | 1) + 1);
+}
+
+/* take ownership of a malloc'd buffer holding len bytes out of bufsize.
+ * Capacities are powers of 2, so a long string adopts buf without copying
+ * only when the largest power of 2 within bufsize still has room for the
+ * terminator, which xs_alloc_size(len) guarantees; otherwise, bufsize 0 or
+ * too small included, buf is reallocated. Short strings are moved inline
+ * and buf is released.
+ */
+xs *xs_new_adopt(xs *x, char *buf, size_t len, size_t bufsize)
+{
+    if (len <= 15) {
+        xs_new_len(x, buf, len);
+        free(buf);
+        return x;
+    }
+    *x = xs_literal_empty();
+    int cap = bufsize > len ? ilog2(bufsize) : 0;
+    if (len + 1 > (size_t) 1 << cap) {
+        cap = ilog2(len + 1) + 1;
+        buf = realloc(buf, (size_t) 1 << cap);
     }
+    buf[len] = 0;
+    x->ptr = buf;
+    x->size = len;
+    x->capacity = cap;
+    x->is_ptr = true;
     return x;
 }
 
@@ -83,13 +179,343 @@ xs *xs_new(xs *x, const void *p)
      }){1}),                                               \
      xs_new(&xs_literal_empty(), "" x))
 
+static inline xs *xs_newempty(xs *x)
+{
+    *x = xs_literal_empty();
+    return x;
+}
+
+/* Deferred free: heap buffers of at least threshold bytes are handed to a
+ * reclaimer instead of going through free() on the caller's thread. The
+ * queue is intrusive, each queued buffer stores the link to the next one,
+ * so queueing never allocates. At most limit bytes wait in the queue; past
+ * that xs_free falls back to freeing synchronously. Without a background
+ * thread, buffers pile up until xs_defer_free_flush at a quiescent point.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake, idle;
+    pthread_t thread;
+    bool background, stop, closed;
+    size_t threshold, limit, pending;
+    char *head;
+} xs_reclaim = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+
+struct xs_reclaim_node {
+    char *next;
+    size_t bytes;
+};
+
+static void xs_reclaim_release(char *p)
+{
+    size_t freed = 0;
+    while (p) {
+        struct xs_reclaim_node *n = (struct xs_reclaim_node *) p;
+        char *next = n->next;
+        freed += n->bytes;
+        free(p);
+        p = next;
+    }
+    pthread_mutex_lock(&xs_reclaim.lock);
+    xs_reclaim.pending -= freed;
+    if (!xs_reclaim.pending)
+        pthread_cond_broadcast(&xs_reclaim.idle);
+    pthread_mutex_unlock(&xs_reclaim.lock);
+}
+
+static void *xs_reclaim_main(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&xs_reclaim.lock);
+    while (!xs_reclaim.stop) {
+        if (!xs_reclaim.head) {
+            pthread_cond_wait(&xs_reclaim.wake, &xs_reclaim.lock);
+            continue;
+        }
+        char *batch = xs_reclaim.head;
+        xs_reclaim.head = NULL;
+        pthread_mutex_unlock(&xs_reclaim.lock);
+        xs_reclaim_release(batch);
+        pthread_mutex_lock(&xs_reclaim.lock);
+    }
+    pthread_mutex_unlock(&xs_reclaim.lock);
+    return NULL;
+}
+
+static bool xs_reclaim_push(char *p, size_t bytes)
+{
+    pthread_mutex_lock(&xs_reclaim.lock);
+    if (xs_reclaim.closed || xs_reclaim.pending + bytes > xs_reclaim.limit) {
+        pthread_mutex_unlock(&xs_reclaim.lock);
+        return false;
+    }
+    struct xs_reclaim_node *n = (struct xs_reclaim_node *) p;
+    n->next = xs_reclaim.head;
+    n->bytes = bytes;
+    xs_reclaim.head = p;
+    xs_reclaim.pending += bytes;
+    if (xs_reclaim.background)
+        pthread_cond_signal(&xs_reclaim.wake);
+    pthread_mutex_unlock(&xs_reclaim.lock);
+    return true;
+}
+
+/* returns false when the caller has to free p itself */
+static inline bool xs_defer_free(char *p, size_t bytes)
+{
+    size_t threshold = __atomic_load_n(&xs_reclaim.threshold, __ATOMIC_RELAXED);
+    if (!threshold || bytes < threshold)
+        return false;
+    return xs_reclaim_push(p, bytes);
+}
+
+/* free everything queued so far and wait for buffers the background thread
+ * is still releasing. This is meant for shutdown or a quiescent point: while
+ * other threads keep queueing, the wait for pending to reach 0 may not end.
+ */
+void xs_defer_free_flush(void)
+{
+    pthread_mutex_lock(&xs_reclaim.lock);
+    char *batch = xs_reclaim.head;
+    xs_reclaim.head = NULL;
+    pthread_mutex_unlock(&xs_reclaim.lock);
+    xs_reclaim_release(batch);
+
+    pthread_mutex_lock(&xs_reclaim.lock);
+    while (xs_reclaim.pending)
+        pthread_cond_wait(&xs_reclaim.idle, &xs_reclaim.lock);
+    pthread_mutex_unlock(&xs_reclaim.lock);
+}
+
+/* threshold: smallest buffer (in bytes) worth deferring, at least 16 */
+bool xs_defer_free_enable(size_t threshold, size_t limit, bool background)
+{
+    if (threshold < sizeof(struct xs_reclaim_node))
+        threshold = sizeof(struct xs_reclaim_node);
+    pthread_mutex_lock(&xs_reclaim.lock);
+    xs_reclaim.limit = limit;
+    xs_reclaim.closed = false;
+    if (background && !xs_reclaim.background) {
+        xs_reclaim.stop = false;
+        if (pthread_create(&xs_reclaim.thread, NULL, xs_reclaim_main, NULL)) {
+            pthread_mutex_unlock(&xs_reclaim.lock);
+            return false;
+        }
+        xs_reclaim.background = true;
+    }
+    __atomic_store_n(&xs_reclaim.threshold, threshold, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&xs_reclaim.lock);
+    return true;
+}
+
+/* stop deferring; buffers queued until then are freed before returning */
+void xs_defer_free_disable(void)
+{
+    __atomic_store_n(&xs_reclaim.threshold, 0, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&xs_reclaim.lock);
+    /* an xs_free that read the old threshold is refused under the lock from
+     * here on, so nothing can be queued behind the final flush
+     */
+    xs_reclaim.closed = true;
+    bool joining = xs_reclaim.background;
+    xs_reclaim.stop = true;
+    xs_reclaim.background = false;
+    pthread_cond_signal(&xs_reclaim.wake);
+    pthread_mutex_unlock(&xs_reclaim.lock);
+    if (joining)
+        pthread_join(xs_reclaim.thread, NULL);
+    xs_defer_free_flush();
+}
+
+/* Epoch-based reclamation for heap buffers read from other threads.
+ * A reader pins the global epoch while it looks at shared strings instead
+ * of touching refcnt, and every reader slot sits on its own cache line.
+ * Writers never modify or free the buffer of a string marked with
+ * xs_epoch_protect (flag2): edits move to a fresh buffer and the old one is
+ * retired. Publishing the updated xs to readers is up to the caller, e.g.
+ * through an atomic pointer to the container holding it, and retirement
+ * happens during the edit, before that. So retired buffers wait in a list
+ * private to the writer thread, and the writer calls xs_epoch_reclaim once
+ * its edits are published: it advances the epoch, stamps its own pending
+ * buffers with the epoch being closed, moves them to the shared list and
+ * frees what no pinned reader can still see. Buffers another writer has
+ * retired but not yet published are never stamped by this call. A writer
+ * thread must reclaim before it exits or its pending buffers leak.
+ */
+#define XS_EPOCH_READERS 128
+
+typedef struct {
+    uint64_t epoch; /* 0 while outside a read section */
+    bool used;
+    char pad[64 - sizeof(uint64_t) - sizeof(bool)];
+} xs_epoch_reader;
+
+static struct {
+    uint64_t epoch;
+    pthread_mutex_t lock;
+    struct xs_retired_node *retired;
+    size_t nretired;
+    xs_epoch_reader readers[XS_EPOCH_READERS] __attribute__((aligned(64)));
+} xs_epochs = {.epoch = 1, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* kept apart from the buffer, which readers may still be looking at */
+struct xs_retired_node {
+    struct xs_retired_node *next;
+    uint64_t epoch;
+    char *p;
+};
+
+/* retired by this thread and not yet published */
+static __thread struct xs_retired_node *xs_epoch_pending;
+
+/* one slot per reader thread, NULL when all are taken */
+xs_epoch_reader *xs_epoch_register(void)
+{
+    for (int i = 0; i < XS_EPOCH_READERS; i++) {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&xs_epochs.readers[i].used, &expected,
+                                        true, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED))
+            return &xs_epochs.readers[i];
+    }
+    return NULL;
+}
+
+void xs_epoch_unregister(xs_epoch_reader *r)
+{
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->used, false, __ATOMIC_RELEASE);
+}
+
+static inline void xs_epoch_enter(xs_epoch_reader *r)
+{
+    __atomic_store_n(&r->epoch,
+                     __atomic_load_n(&xs_epochs.epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void xs_epoch_exit(xs_epoch_reader *r)
+{
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* free every retired buffer older than the oldest pinned epoch */
+void xs_epoch_reclaim(void)
+{
+    uint64_t now = __atomic_add_fetch(&xs_epochs.epoch, 1, __ATOMIC_SEQ_CST),
+             min = now;
+    for (int i = 0; i < XS_EPOCH_READERS; i++) {
+        uint64_t e = __atomic_load_n(&xs_epochs.readers[i].epoch,
+                                     __ATOMIC_SEQ_CST);
+        if (e && e < min)
+            min = e;
+    }
+
+    pthread_mutex_lock(&xs_epochs.lock);
+    struct xs_retired_node *n, **link = &xs_epochs.retired;
+    while ((n = xs_epoch_pending)) {
+        xs_epoch_pending = n->next;
+        n->epoch = now - 1;
+        n->next = xs_epochs.retired;
+        xs_epochs.retired = n;
+        xs_epochs.nretired++;
+    }
+    while ((n = *link)) {
+        if (n->epoch < min) {
+            *link = n->next;
+            free(n->p);
+            free(n);
+            xs_epochs.nretired--;
+        } else
+            link = &n->next;
+    }
+    pthread_mutex_unlock(&xs_epochs.lock);
+}
+
+/* queue a heap buffer until the readers move on, its bytes stay intact */
+void xs_epoch_retire(char *p)
+{
+    struct xs_retired_node *n = malloc(sizeof(*n));
+    n->p = p;
+    n->epoch = 0; /* stamped by this thread's next xs_epoch_reclaim */
+    n->next = xs_epoch_pending;
+    xs_epoch_pending = n;
+}
+
+/* *refcnt counts the xs_cpy copies sharing an owner's buffer. An owner that
+ * lets go while copies remain adds XS_REF_ORPHAN instead of freeing, and
+ * the last copy to let go frees the buffer and the count.
+ */
+#define XS_REF_ORPHAN (1 << 30)
+
+/* a copy stops using the shared buffer ptr */
+static inline void xs_share_release(char *ptr, int *refcnt)
+{
+    if (--*refcnt == XS_REF_ORPHAN) {
+        free(ptr);
+        free(refcnt);
+    }
+}
+
+/* the owner stops using its buffer, false when copies keep it alive */
+static inline bool xs_owner_release(xs *x)
+{
+    int *refcnt = x->flag3 ? NULL : x->refcnt;
+    x->refcnt = NULL;
+    if (!refcnt)
+        return true;
+    if (!*refcnt) {
+        free(refcnt);
+        return true;
+    }
+    *refcnt += XS_REF_ORPHAN;
+    return false;
+}
+
+/* flag1 marks a heap buffer this string does not own: either shared through
+ * refcnt by xs_cpy, or borrowed from a batch arena when refcnt is NULL.
+ */
+static inline xs *xs_free(xs *x)
+{
+    if (xs_is_ptr(x)) {
+        if (x->flag1) {
+            if (x->refcnt)
+                xs_share_release(x->ptr, x->refcnt);
+        } else if (xs_owner_release(x)) {
+            if (x->flag2)
+                xs_epoch_retire(x->ptr);
+            else if (!xs_defer_free(x->ptr, (size_t) 1 << x->capacity))
+                free(x->ptr);
+        }
+    }
+    return xs_newempty(x);
+}
+
 /* grow up to specified size */
 xs *xs_grow(xs *x, size_t len)
 {
+    xs_data(x);
     if (len <= xs_capacity(x))
         return x;
     len = ilog2(len) + 1;
-    if (xs_is_ptr(x))
+    if (xs_is_ptr(x) && (x->flag1 || x->flag2 || x->refcnt)) {
+        /* never realloc a buffer that is not ours, that copies share or
+         * that readers may be looking at, move to a new one
+         */
+        size_t size = x->size;
+        bool epoch = x->flag2;
+        char *buf = malloc((size_t) 1 << len);
+        memcpy(buf, x->ptr, size + 1);
+        xs_free(x);
+        x->ptr = buf;
+        x->size = size;
+        x->flag2 = epoch;
+    } else if (xs_is_ptr(x))
         x->ptr = realloc(x->ptr, (size_t) 1 << len);
     else {
         char buf[16];
@@ -102,19 +528,6 @@ xs *xs_grow(xs *x, size_t len)
     return x;
 }
 
-static inline xs *xs_newempty(xs *x)
-{
-    *x = xs_literal_empty();
-    return x;
-}
-
-static inline xs *xs_free(xs *x)
-{
-    if (xs_is_ptr(x))
-        free(xs_data(x));
-    return xs_newempty(x);
-}
-
 xs *xs_concat(xs *string, const xs *prefix, const xs *suffix)
 {
     size_t pres = xs_size(prefix), sufs = xs_size(suffix),
@@ -123,21 +536,25 @@ xs *xs_concat(xs *string, const xs *prefix, const xs *suffix)
     char *pre = xs_data(prefix), *suf = xs_data(suffix),
          *data = xs_data(string);
 
-    if (size + pres + sufs <= capacity) {
-        if(string->flag1 && string->refcnt && *(string->refcnt) > 0){
-            /* create new space */
-            *(string->refcnt) -= 1;
+    /* an owner whose copies still share the buffer must not edit it */
+    bool shared = xs_is_ptr(string) && !string->flag1 && string->refcnt;
+    if (size + pres + sufs <= capacity && !string->flag2 && !shared) {
+        if (xs_is_ptr(string) && string->flag1 && string->refcnt) {
+            /* a copy moves to a private buffer first */
+            char *old = string->ptr;
+            data = string->ptr = malloc(capacity + 1);
+            memcpy(data, old, size);
+            xs_share_release(old, string->refcnt);
             string->flag1 = false;
-            data = string->ptr = (char*)malloc(sizeof(char) * capacity);
-            if(*(string->refcnt) == 0){
-                free(string->refcnt);
-                string->refcnt = NULL;
-            }
+            string->refcnt = NULL;
         }
         memmove(data + pres, data, size);
         memcpy(data, pre, pres);
         memcpy(data + pres + size, suf, sufs + 1);
-        string->space_left = 15 - (size + pres + sufs);
+        if (xs_is_ptr(string))
+            string->size = size + pres + sufs;
+        else
+            string->space_left = 15 - (size + pres + sufs);
     } else {
         xs tmps = xs_literal_empty();
         xs_grow(&tmps, size + pres + sufs);
@@ -145,17 +562,10 @@ xs *xs_concat(xs *string, const xs *prefix, const xs *suffix)
         memcpy(tmpdata + pres, data, size);
         memcpy(tmpdata, pre, pres);
         memcpy(tmpdata + pres + size, suf, sufs + 1);
-        if(string->flag1 && string->refcnt && *(string->refcnt) > 0){
-            *(string->refcnt) -= 1;
-            if(*(string->refcnt) == 0){
-                free(string->refcnt);
-                string->refcnt = NULL;
-            }
-        }else
-        {
-            xs_free(string);
-        }
+        bool epoch = xs_is_ptr(string) && string->flag2;
+        xs_free(string);
         tmps.flag1 = false;
+        tmps.flag2 = epoch;
         *string = tmps;
         string->size = size + pres + sufs;
     }
@@ -192,17 +602,27 @@ xs *xs_trim(xs *x, const char *trimset)
      * Do not reallocate immediately. Instead, reuse it as possible.
      * Do not shrink to in place if < 16 bytes.
      */
-    if(x->flag1 && x->refcnt && *(x->refcnt) > 0){
-        x->ptr = orig = (char*)malloc(sizeof(char) * strlen(x->ptr));
-        *(x->refcnt) -= 1;
-        if(*(x->refcnt) == 0){
-            free(x->refcnt);
-            x->refcnt = NULL;
-        }
+    char *old = NULL;
+    if (xs_is_ptr(x) && (x->flag2 || x->refcnt)) {
+        /* epoch readers or copies may still be on the old buffer, let go
+         * of it once copied
+         */
+        old = x->ptr;
+        x->ptr = orig = malloc((size_t) 1 << x->capacity);
     }
     memmove(orig, dataptr, slen);
+    if (old) {
+        if (x->flag2)
+            xs_epoch_retire(old);
+        else if (x->flag1)
+            xs_share_release(old, x->refcnt);
+        else if (xs_owner_release(x))
+            free(old);
+        x->flag1 = false;
+        x->refcnt = NULL;
+    }
     /* do not dirty memory unless it is needed */
-    if (orig[slen])
+    if (old || orig[slen])
         orig[slen] = 0;
 
     if (xs_is_ptr(x))
@@ -217,15 +637,26 @@ xs *xs_trim(xs *x, const char *trimset)
 
 xs *xs_cpy(xs *dest, xs *src){
 
+    /* a gap buffer cannot be shared as it is */
+    xs_data(src);
+    if (xs_is_ptr(src) && ((src->flag1 && !src->refcnt) || src->flag2)) {
+        /* borrowed from a batch arena that may go away first, or retired
+         * to epoch readers, which a copy knows nothing about
+         */
+        return xs_new_from_xs(dest, src);
+    }
     if (xs_is_ptr(src)){
         /* string is on heap */
         dest->is_ptr = true;
         dest->ptr = src->ptr;
         dest->flag1 = true;
+        dest->flag2 = false;
+        dest->flag3 = false;
         /*
         Remind: don't use strlen(src->data) as r-value
         */
         dest->size = xs_size(src);
+        dest->capacity = src->capacity;
         if(!src->refcnt){
             dest->refcnt = src->refcnt = (int*)malloc(sizeof(int));
             *(dest->refcnt) = 1;
@@ -234,14 +665,180 @@ xs *xs_cpy(xs *dest, xs *src){
             *(dest->refcnt) += 1;
         }
     } else {
-        /* string is on stack */
-        memcpy(dest->data, src->data , xs_size(src));
-        dest->is_ptr = false;
-        dest->space_left = 15 - xs_size(src);
+        /* string is on stack; dest may be uninitialized, so this also sets
+         * the terminator and clears the flags
+         */
+        xs_new_len(dest, src->data, xs_size(src));
+    }
+    return dest;
+}
+
+/* Build n strings from C strings with a single allocation. All inputs are
+ * measured in one pass first; short strings go inline and long ones are
+ * packed back to back into one arena, which the strings borrow (flag1 with
+ * no refcnt). Returns the arena, or NULL when every string was short.
+ * Release the whole group with xs_free_batch.
+ */
+char *xs_new_batch(xs *out, const char *const *src, size_t n)
+{
+    size_t i, total = 0;
+
+    /* stash each length in the slot it will be built in */
+    for (i = 0; i < n; i++) {
+        size_t len = strlen(src[i]);
+        out[i].size = len;
+        if (len > 15)
+            total += len + 1;
     }
+
+    char *arena = total ? malloc(total) : NULL, *p = arena;
+    for (i = 0; i < n; i++) {
+        size_t len = out[i].size;
+        if (len <= 15) {
+            xs_new_len(&out[i], src[i], len);
+            continue;
+        }
+        memcpy(p, src[i], len + 1);
+        out[i] = xs_literal_empty();
+        out[i].ptr = p;
+        out[i].size = len;
+        /* never claim more than the slot, so appends move out of it */
+        out[i].capacity = ilog2(len + 1);
+        out[i].is_ptr = true;
+        out[i].flag1 = true;
+        p += len + 1;
+    }
+    return arena;
+}
+
+/* strings that outgrew their arena slot own their buffer and are freed
+ * one by one, the arena itself goes at once
+ */
+void xs_free_batch(xs *arr, size_t n, char *arena)
+{
+    for (size_t i = 0; i < n; i++)
+        xs_free(&arr[i]);
+    free(arena);
+}
+
+/* mark a heap string as read by epoch readers from now on; a string that
+ * shares or borrows its buffer gets a private copy first
+ */
+xs *xs_epoch_protect(xs *x)
+{
+    /* readers must never see a gap or a buffer that copies still share */
+    xs_data(x);
+    if (!xs_is_ptr(x))
+        return x;
+    if (x->flag1 || x->refcnt) {
+        /* same-size private copy; xs_grow would double the capacity */
+        xs tmp;
+        xs_new_len(&tmp, xs_data(x), xs_size(x));
+        xs_free(x);
+        *x = tmp;
+    }
+    x->flag2 = true;
+    return x;
+}
+
+/* O(1) ownership transfer: dest takes over src's storage as-is, including
+ * a shared heap buffer together with its refcnt, so no count is touched.
+ * src is left empty. dest is overwritten and must not own a buffer.
+ */
+static inline xs *xs_move(xs *dest, xs *src)
+{
+    *dest = *src;
+    xs_newempty(src);
     return dest;
 }
 
+/* return the string by value and leave x empty */
+static inline xs xs_take(xs *x)
+{
+    xs tmp = *x;
+    xs_newempty(x);
+    return tmp;
+}
+
+static inline void xs_swap(xs *a, xs *b)
+{
+    xs tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* 256-bit byte set, the same layout xs_trim builds on the stack */
+static inline void xs_charset_init(uint8_t set[32], const char *chars)
+{
+    memset(set, 0, 32);
+    for (; *chars; chars++)
+        set[(uint8_t) *chars / 8] |= 1 << (uint8_t) *chars % 8;
+}
+
+static inline bool xs_charset_has(const uint8_t set[32], char c)
+{
+    return set[(uint8_t) c / 8] & 1 << (uint8_t) c % 8;
+}
+
+/* Lazy, reentrant replacement for xs_strtok: the state lives in the
+ * caller's xs_tokenizer and every token is a view into the source, so
+ * nothing is copied, the source is not modified and embedded NULs are fine.
+ * The source must outlive the tokenizer.
+ */
+typedef struct {
+    const char *cur, *end;
+    uint8_t delim[32];
+    bool lines;
+} xs_tokenizer;
+
+/* yield every line without its "\n" or "\r\n"; empty lines are kept */
+void xs_lines_begin(xs_tokenizer *t, const xs *x)
+{
+    t->cur = xs_data(x);
+    t->end = t->cur + xs_size(x);
+    t->lines = true;
+}
+
+/* yield maximal runs of bytes not in delims, like strtok */
+void xs_tokens_begin(xs_tokenizer *t, const xs *x, const char *delims)
+{
+    t->cur = xs_data(x);
+    t->end = t->cur + xs_size(x);
+    t->lines = false;
+    xs_charset_init(t->delim, delims);
+}
+
+bool xs_token_next(xs_tokenizer *t, xs_view *tok)
+{
+    const char *p = t->cur, *end = t->end;
+
+    if (t->lines) {
+        if (p == end)
+            return false;
+        const char *nl = memchr(p, '\n', end - p);
+        const char *stop = nl ? nl : end;
+        t->cur = nl ? nl + 1 : end;
+        if (stop > p && stop[-1] == '\r')
+            stop--;
+        tok->ptr = p;
+        tok->len = stop - p;
+        return true;
+    }
+
+    while (p < end && xs_charset_has(t->delim, *p))
+        p++;
+    if (p == end) {
+        t->cur = end;
+        return false;
+    }
+    tok->ptr = p;
+    while (p < end && !xs_charset_has(t->delim, *p))
+        p++;
+    tok->len = p - tok->ptr;
+    t->cur = p;
+    return true;
+}
+
 char *xs_strtok(char *x, const char *delimit)
 {
     static char *lastToken = NULL; /* UNSAFE SHARED STATE! */
@@ -267,42 +864,4599 @@ char *xs_strtok(char *x, const char *delimit)
     return x;
 }
 
+/* Multi-producer, single-consumer append buffer. Producers reserve a byte
+ * range of the current segment with one atomic fetch-add and copy into it
+ * without taking a lock. Whoever runs past the end of a segment links a new
+ * one with a compare-and-swap, so the chain grows lock-free. The consumer
+ * seals the oldest segment, waits for writers still copying into it and
+ * takes its buffer as an xs without copying.
+ */
+struct xs_mpsc_segment {
+    size_t reserved;  /* next offset handed out, may run past capacity */
+    size_t committed; /* bytes copied in plus the unusable tail */
+    size_t end;       /* length of the data once the segment is sealed */
+    size_t capacity;
+    struct xs_mpsc_segment *next, *retired;
+    char *data;
+};
 
-int main()
+typedef struct {
+    struct xs_mpsc_segment *head, *tail;
+    struct xs_mpsc_segment *retired, *retiring;
+    size_t segment_size;
+    /* producers that may hold a segment pointer, counted by the parity of
+     * the generation they started in
+     */
+    size_t inflight[2];
+    size_t gen;
+} xs_mpsc_buffer;
+
+static struct xs_mpsc_segment *xs_mpsc_segment_new(size_t len)
 {
+    struct xs_mpsc_segment *seg = calloc(1, sizeof(*seg));
+    int cap = ilog2(len + 1) + 1;
+    seg->capacity = ((size_t) 1 << cap) - 1;
+    seg->end = seg->capacity;
+    seg->data = malloc((size_t) 1 << cap);
+    return seg;
+}
 
-    /* Testing xs_strtok */
-    xs str = *xs_new(&str,"asd:aee:gdw:tfv:ddd");
-    char *pch = strtok(xs_data(&str) ,":");
-    while (pch != NULL)
-    {
-        printf ("%s ",pch);
-        pch = strtok (NULL, ":");
+/* make sure seg has a successor and move the shared tail past seg */
+static struct xs_mpsc_segment *xs_mpsc_advance(xs_mpsc_buffer *b,
+                                               struct xs_mpsc_segment *seg,
+                                               size_t len)
+{
+    struct xs_mpsc_segment *next = __atomic_load_n(&seg->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        struct xs_mpsc_segment *fresh =
+            xs_mpsc_segment_new(len > b->segment_size ? len : b->segment_size);
+        if (__atomic_compare_exchange_n(&seg->next, &next, fresh, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            next = fresh;
+        else {
+            free(fresh->data);
+            free(fresh);
+        }
     }
-    printf("\n");
+    __atomic_compare_exchange_n(&b->tail, &seg, next, false, __ATOMIC_ACQ_REL,
+                                __ATOMIC_RELAXED);
+    return next;
+}
 
-    //xs string = *xs_tmp("\n foobarbar \n\n\n");
-    //xs_trim(&string, "\n ");
-    /*xs prefix = *xs_tmp("((((((("), suffix = *xs_tmp("))))))))))))");
-    xs string = *xs_new(&string,"aoaoaoaofoobarbar");
-    xs_concat(&string, &prefix, &suffix);
-    xs string_cpy = *xs_cpy(&xs_literal_empty(),&string);
-    xs_trim(&string_cpy,"(");*/
-    //xs hihi = *xs_cpy(&xs_literal_empty(),&string);
-    //xs qq = *xs_cpy(&xs_literal_empty(),&hihi);
+/* claim [0, capacity) from off on, when a reservation crosses the end */
+static void xs_mpsc_seal_at(struct xs_mpsc_segment *seg, size_t off)
+{
+    if (off >= seg->capacity)
+        return;
+    seg->end = off;
+    __atomic_fetch_add(&seg->committed, seg->capacity - off, __ATOMIC_RELEASE);
+}
 
-    //xs_concat(&string_cpy, &prefix, &suffix);
-    //printf("[%s] : %2zu\n", xs_data(&string_cpy), xs_size(&string_cpy));
-    //printf("[%s] : %2zu\n", xs_data(&string), xs_size(&string));
-    //printf("%d\n",*string.refcnt);
-    //printf("[%s] : %2zu\n", xs_data(&string), xs_size(&string));
-    /*xs string = *xs_tmp("\n foobarbar \n\n\n");
-    xs_trim(&string, "\n ");
-    printf("[%s] : %2zu\n", xs_data(&string), xs_size(&string));
-    */
-    /*xs prefix = *xs_tmp("((("), suffix = *xs_tmp(")))");
-    xs_concat(&string, &prefix, &suffix);
-    printf("[%s] : %2zu\n", xs_data(&string), xs_size(&string));
-    */
-    return 0;
+void xs_mpsc_init(xs_mpsc_buffer *b, size_t segment_size)
+{
+    b->segment_size = segment_size;
+    b->head = b->tail = xs_mpsc_segment_new(segment_size);
+    b->retired = b->retiring = NULL;
+    b->inflight[0] = b->inflight[1] = 0;
+    b->gen = 0;
+}
+
+void xs_mpsc_append(xs_mpsc_buffer *b, const void *p, size_t len)
+{
+    size_t *inflight;
+    for (;;) {
+        size_t gen = __atomic_load_n(&b->gen, __ATOMIC_SEQ_CST);
+        inflight = &b->inflight[gen & 1];
+        __atomic_fetch_add(inflight, 1, __ATOMIC_SEQ_CST);
+        /* a stale generation could keep a segment alive unnoticed */
+        if (__atomic_load_n(&b->gen, __ATOMIC_SEQ_CST) == gen)
+            break;
+        __atomic_fetch_sub(inflight, 1, __ATOMIC_SEQ_CST);
+    }
+    struct xs_mpsc_segment *seg = __atomic_load_n(&b->tail, __ATOMIC_SEQ_CST);
+    for (;;) {
+        size_t off = __atomic_fetch_add(&seg->reserved, len, __ATOMIC_RELAXED);
+        if (off + len <= seg->capacity) {
+            memcpy(seg->data + off, p, len);
+            __atomic_fetch_add(&seg->committed, len, __ATOMIC_RELEASE);
+            break;
+        }
+        xs_mpsc_seal_at(seg, off);
+        seg = xs_mpsc_advance(b, seg, len);
+    }
+    __atomic_fetch_sub(inflight, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void xs_mpsc_append_xs(xs_mpsc_buffer *b, const xs *x)
+{
+    xs_mpsc_append(b, xs_data(x), xs_size(x));
+}
+
+/* Hand the oldest full segment to the consumer as an xs. With flush set, a
+ * partially filled segment is sealed and handed out as well, so draining
+ * until false returns everything appended so far. Single consumer only.
+ */
+bool xs_mpsc_pop(xs_mpsc_buffer *b, xs *out, bool flush)
+{
+    for (;;) {
+        struct xs_mpsc_segment *seg = b->head;
+        if (!__atomic_load_n(&seg->next, __ATOMIC_ACQUIRE)) {
+            if (!flush || !__atomic_load_n(&seg->reserved, __ATOMIC_RELAXED))
+                return false;
+            xs_mpsc_seal_at(seg, __atomic_fetch_add(&seg->reserved,
+                                                    seg->capacity + 1,
+                                                    __ATOMIC_RELAXED));
+            xs_mpsc_advance(b, seg, 0);
+        }
+        size_t seg_bytes = seg->capacity + 1;
+        /* wait for producers still copying into their ranges */
+        while (__atomic_load_n(&seg->committed, __ATOMIC_ACQUIRE) <
+               seg->capacity)
+            sched_yield();
+
+        size_t end = seg->end;
+        char *data = seg->data;
+        struct xs_mpsc_segment *expected = seg;
+        b->head = __atomic_load_n(&seg->next, __ATOMIC_ACQUIRE);
+        __atomic_compare_exchange_n(&b->tail, &expected, b->head, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        seg->retired = b->retired;
+        b->retired = seg;
+
+        /* Segments retired in the previous generation can only be seen by
+         * producers that started in it. Once those are gone, free them and
+         * open a new generation, so headers are reclaimed even while other
+         * producers keep running.
+         */
+        size_t gen = b->gen;
+        if (!__atomic_load_n(&b->inflight[(gen + 1) & 1], __ATOMIC_SEQ_CST)) {
+            while (b->retiring) {
+                struct xs_mpsc_segment *r = b->retiring;
+                b->retiring = r->retired;
+                free(r);
+            }
+            b->retiring = b->retired;
+            b->retired = NULL;
+            __atomic_store_n(&b->gen, gen + 1, __ATOMIC_SEQ_CST);
+        }
+
+        if (end) {
+            xs_new_adopt(out, data, end, seg_bytes);
+            return true;
+        }
+        free(data);
+    }
+}
+
+/* no producer may be running */
+void xs_mpsc_destroy(xs_mpsc_buffer *b)
+{
+    while (b->retired) {
+        struct xs_mpsc_segment *r = b->retired;
+        b->retired = r->retired;
+        free(r);
+    }
+    while (b->retiring) {
+        struct xs_mpsc_segment *r = b->retiring;
+        b->retiring = r->retired;
+        free(r);
+    }
+    for (struct xs_mpsc_segment *seg = b->head, *next; seg; seg = next) {
+        next = seg->next;
+        free(seg->data);
+        free(seg);
+    }
+}
+
+/* Gap buffer mode (flag3) for strings edited around a cursor. The free
+ * space of the heap buffer is kept at the cursor, so inserting and deleting
+ * there only touches the edited bytes, and moving the cursor moves as many
+ * bytes as it travels. Everything else in this file calls xs_data, which
+ * closes the gap lazily and turns the string back into a plain one, so the
+ * cursor ends up at the end of the string; xs_gap_view reads the text
+ * without that and keeps the cursor where it is. That makes xs_data write to the string even through a const xs *, so a
+ * string in gap mode must be compacted (any xs_data call) by its editor
+ * before other threads read it, e.g. through xs_par_* or epoch readers.
+ * Epoch-protected strings are never edited in place, which is what a gap
+ * buffer is for, so the gap functions return NULL on them.
+ */
+static bool xs_gap_reserve(xs *x, size_t extra)
+{
+    size_t size = xs_size(x);
+    if (xs_is_ptr(x) && x->flag2)
+        return false;
+    if (xs_is_ptr(x) && x->flag3 && size + extra <= xs_capacity(x))
+        return true;
+
+    size_t cursor = xs_is_ptr(x) && x->flag3 ? x->gap : size;
+    char *data = xs_data(x);
+    if (!xs_is_ptr(x) || x->flag1 || x->refcnt ||
+        size + extra > xs_capacity(x)) {
+        /* a private buffer with room to spare keeps inserts amortized O(1) */
+        int cap = ilog2(size + extra + 1) + 1;
+        char *buf = malloc((size_t) 1 << cap);
+        memcpy(buf, data, size);
+        xs_free(x);
+        x->ptr = buf;
+        x->size = size;
+        x->capacity = cap;
+        x->is_ptr = true;
+    }
+    /* a compacted string is a gap buffer with the gap at the end */
+    size_t gaplen = xs_capacity(x) - size;
+    x->flag3 = true;
+    x->gap = cursor;
+    memmove(x->ptr + cursor + gaplen, x->ptr + cursor, size - cursor);
+    return true;
+}
+
+static inline size_t xs_gap_cursor(const xs *x)
+{
+    return xs_is_ptr(x) && x->flag3 ? x->gap : xs_size(x);
+}
+
+/* the text before and after the cursor, read in place without closing the
+ * gap; a string not in gap mode is all before the cursor
+ */
+static inline void xs_gap_view(const xs *x, xs_view *before, xs_view *after)
+{
+    if (!xs_is_ptr(x) || !x->flag3) {
+        *before = xs_view_of(x);
+        *after = (xs_view){before->ptr + before->len, 0};
+        return;
+    }
+    size_t gaplen = xs_capacity(x) - x->size;
+    *before = (xs_view){x->ptr, x->gap};
+    *after = (xs_view){x->ptr + x->gap + gaplen, x->size - x->gap};
+}
+
+xs *xs_gap_move(xs *x, size_t pos)
+{
+    if (!xs_gap_reserve(x, 0))
+        return NULL;
+    if (pos > x->size)
+        pos = x->size;
+    size_t gaplen = xs_capacity(x) - x->size;
+    if (pos < x->gap)
+        memmove(x->ptr + pos + gaplen, x->ptr + pos, x->gap - pos);
+    else
+        memmove(x->ptr + x->gap, x->ptr + x->gap + gaplen, pos - x->gap);
+    x->gap = pos;
+    return x;
+}
+
+/* insert at the cursor and leave the cursor after the inserted bytes */
+xs *xs_gap_insert(xs *x, const void *p, size_t len)
+{
+    if (!xs_gap_reserve(x, len))
+        return NULL;
+    memcpy(x->ptr + x->gap, p, len);
+    x->gap += len;
+    x->size += len;
+    return x;
+}
+
+/* the text after the gap always ends at the end of the buffer, so shrinking
+ * size grows the gap over the bytes that follow the cursor
+ */
+xs *xs_gap_delete(xs *x, size_t len)
+{
+    if (!xs_gap_reserve(x, 0))
+        return NULL;
+    if (len > x->size - x->gap)
+        len = x->size - x->gap;
+    x->size -= len;
+    return x;
+}
+
+/* delete len bytes before the cursor */
+xs *xs_gap_backspace(xs *x, size_t len)
+{
+    if (!xs_gap_reserve(x, 0))
+        return NULL;
+    if (len > x->gap)
+        len = x->gap;
+    x->gap -= len;
+    x->size -= len;
+    return x;
+}
+
+/* Piece table for large documents with scattered edits. The table takes
+ * over the original text from the xs it came from and never modifies it,
+ * inserted text is appended to a private add buffer, and the document is
+ * the in-order concatenation of pieces, each a range of one of the two
+ * buffers. Pieces live in a persistent treap keyed by position: an edit
+ * copies only the O(log n) nodes on its path and never modifies existing
+ * nodes, so taking an undo snapshot is grabbing a reference to the current
+ * root.
+ */
+struct xs_piece {
+    struct xs_piece *left, *right;
+    size_t off, len;  /* range in the original or the add buffer */
+    size_t total;     /* bytes in this subtree */
+    uint32_t prio;
+    int refcnt;
+    bool add;
+};
+
+typedef struct {
+    xs orig;         /* owned original text, read-only */
+    char *addbuf;
+    size_t addlen, addcap;
+    struct xs_piece *root;
+    uint32_t seed;
+} xs_piece_table;
+
+typedef struct xs_piece *xs_piece_snapshot;
+
+static inline size_t xs_piece_total(const struct xs_piece *n)
+{
+    return n ? n->total : 0;
+}
+
+static inline struct xs_piece *xs_piece_ref(struct xs_piece *n)
+{
+    if (n)
+        n->refcnt++;
+    return n;
+}
+
+static void xs_piece_unref(struct xs_piece *n)
+{
+    while (n && --n->refcnt == 0) {
+        struct xs_piece *right = n->right;
+        xs_piece_unref(n->left);
+        free(n);
+        n = right;
+    }
+}
+
+/* new node taking over the references to left and right */
+static struct xs_piece *xs_piece_node(const struct xs_piece *proto,
+                                      struct xs_piece *left,
+                                      struct xs_piece *right)
+{
+    struct xs_piece *n = malloc(sizeof(*n));
+    *n = *proto;
+    n->left = left;
+    n->right = right;
+    n->total = xs_piece_total(left) + n->len + xs_piece_total(right);
+    n->refcnt = 1;
+    return n;
+}
+
+/* split t into [0, pos) and [pos, total) without touching t, cutting the
+ * piece that straddles pos in two
+ */
+static void xs_piece_split(struct xs_piece *t, size_t pos, struct xs_piece **l,
+                           struct xs_piece **r)
+{
+    if (!t) {
+        *l = *r = NULL;
+        return;
+    }
+    size_t lt = xs_piece_total(t->left);
+    if (pos <= lt) {
+        struct xs_piece *a;
+        xs_piece_split(t->left, pos, l, &a);
+        *r = xs_piece_node(t, a, xs_piece_ref(t->right));
+    } else if (pos >= lt + t->len) {
+        struct xs_piece *b;
+        xs_piece_split(t->right, pos - lt - t->len, &b, r);
+        *l = xs_piece_node(t, xs_piece_ref(t->left), b);
+    } else {
+        struct xs_piece head = *t, tail = *t;
+        head.len = pos - lt;
+        tail.off += head.len;
+        tail.len -= head.len;
+        *l = xs_piece_node(&head, xs_piece_ref(t->left), NULL);
+        *r = xs_piece_node(&tail, NULL, xs_piece_ref(t->right));
+    }
+}
+
+/* concatenate, consuming the references to l and r */
+static struct xs_piece *xs_piece_merge(struct xs_piece *l, struct xs_piece *r)
+{
+    if (!l)
+        return r;
+    if (!r)
+        return l;
+    struct xs_piece *n;
+    if (l->prio > r->prio) {
+        n = xs_piece_node(l, xs_piece_ref(l->left),
+                          xs_piece_merge(xs_piece_ref(l->right), r));
+        xs_piece_unref(l);
+    } else {
+        n = xs_piece_node(r, xs_piece_merge(l, xs_piece_ref(r->left)),
+                          xs_piece_ref(r->right));
+        xs_piece_unref(r);
+    }
+    return n;
+}
+
+static inline uint32_t xs_piece_rand(xs_piece_table *pt)
+{
+    /* xorshift32 */
+    pt->seed ^= pt->seed << 13;
+    pt->seed ^= pt->seed >> 17;
+    pt->seed ^= pt->seed << 5;
+    return pt->seed;
+}
+
+/* src is consumed and left empty: a private buffer is moved in as it is,
+ * one that copies share or that is borrowed is copied, so nobody else can
+ * edit or free the original text under the table
+ */
+void xs_piece_init(xs_piece_table *pt, xs *src)
+{
+    xs_data(src);
+    if (xs_is_ptr(src) && (src->flag1 || src->refcnt)) {
+        xs_new_from_xs(xs_newempty(&pt->orig), src);
+        xs_free(src);
+    } else
+        xs_move(xs_newempty(&pt->orig), src);
+    pt->addbuf = NULL;
+    pt->addlen = pt->addcap = 0;
+    pt->seed = 2463534242u;
+    pt->root = NULL;
+    if (xs_size(&pt->orig)) {
+        struct xs_piece p = {.len = xs_size(&pt->orig),
+                             .prio = xs_piece_rand(pt)};
+        pt->root = xs_piece_node(&p, NULL, NULL);
+    }
+}
+
+static inline size_t xs_piece_size(const xs_piece_table *pt)
+{
+    return xs_piece_total(pt->root);
+}
+
+xs_piece_table *xs_piece_insert(xs_piece_table *pt, size_t pos, const void *p,
+                                size_t len)
+{
+    if (!len)
+        return pt;
+    if (pos > xs_piece_size(pt))
+        pos = xs_piece_size(pt);
+    if (pt->addlen + len > pt->addcap) {
+        pt->addcap = (size_t) 1 << (ilog2(pt->addlen + len) + 1);
+        pt->addbuf = realloc(pt->addbuf, pt->addcap);
+    }
+    memcpy(pt->addbuf + pt->addlen, p, len);
+
+    struct xs_piece piece = {
+        .off = pt->addlen, .len = len, .prio = xs_piece_rand(pt), .add = true};
+    pt->addlen += len;
+
+    struct xs_piece *l, *r, *old = pt->root;
+    xs_piece_split(old, pos, &l, &r);
+    pt->root = xs_piece_merge(xs_piece_merge(l, xs_piece_node(&piece, NULL, NULL)), r);
+    xs_piece_unref(old);
+    return pt;
+}
+
+xs_piece_table *xs_piece_erase(xs_piece_table *pt, size_t pos, size_t len)
+{
+    size_t size = xs_piece_size(pt);
+    if (pos >= size || !len)
+        return pt;
+    if (len > size - pos)
+        len = size - pos;
+
+    struct xs_piece *l, *mid, *r, *rest, *old = pt->root;
+    xs_piece_split(old, pos, &l, &rest);
+    xs_piece_split(rest, len, &mid, &r);
+    xs_piece_unref(rest);
+    xs_piece_unref(mid);
+    pt->root = xs_piece_merge(l, r);
+    xs_piece_unref(old);
+    return pt;
+}
+
+/* O(1): pieces are never modified, so the root describes this version for
+ * as long as the snapshot holds a reference to it
+ */
+static inline xs_piece_snapshot xs_piece_snapshot_take(xs_piece_table *pt)
+{
+    return xs_piece_ref(pt->root);
+}
+
+/* go back to a snapshot, which stays valid and can be restored again */
+void xs_piece_restore(xs_piece_table *pt, xs_piece_snapshot snap)
+{
+    struct xs_piece *old = pt->root;
+    pt->root = xs_piece_ref(snap);
+    xs_piece_unref(old);
+}
+
+static inline void xs_piece_snapshot_release(xs_piece_snapshot snap)
+{
+    xs_piece_unref(snap);
+}
+
+static char *xs_piece_copy(const xs_piece_table *pt, const struct xs_piece *n,
+                           char *out)
+{
+    for (; n; n = n->right) {
+        out = xs_piece_copy(pt, n->left, out);
+        memcpy(out, (n->add ? pt->addbuf : xs_data(&pt->orig)) + n->off,
+               n->len);
+        out += n->len;
+    }
+    return out;
+}
+
+/* materialize the current version as a normal xs */
+xs *xs_piece_flatten(const xs_piece_table *pt, xs *out)
+{
+    size_t size = xs_piece_size(pt);
+    size_t bufsize = xs_alloc_size(size);
+    char *buf = malloc(bufsize);
+    xs_piece_copy(pt, pt->root, buf);
+    return xs_new_adopt(out, buf, size, bufsize);
+}
+
+/* snapshots taken from pt own their pieces but still read pt's buffers */
+void xs_piece_free(xs_piece_table *pt)
+{
+    xs_piece_unref(pt->root);
+    free(pt->addbuf);
+    xs_free(&pt->orig);
+}
+
+/* put a string rebuilt into a fresh buffer back under epoch protection */
+static inline xs *xs_keep_epoch(xs *x, bool epoch)
+{
+    if (xs_is_ptr(x))
+        x->flag2 = epoch;
+    return x;
+}
+
+/* make x safe to modify in place: a buffer that is shared from either
+ * side, borrowed or may be read by epoch readers is replaced with a private
+ * copy first; a protected string stays protected
+ */
+static char *xs_make_writable(xs *x)
+{
+    char *data = xs_data(x);
+    if (xs_is_ptr(x) && (x->flag1 || x->flag2 || x->refcnt)) {
+        bool epoch = x->flag2;
+        xs tmp;
+        xs_new_len(&tmp, data, xs_size(x));
+        xs_free(x);
+        *x = tmp;
+        xs_keep_epoch(x, epoch);
+    }
+    return xs_data(x);
+}
+
+/* memmem that tests 16 or 32 candidate positions per step: a position is
+ * only compared in full when both its first and its last byte match
+ */
+static const char *xs_memmem(const char *h, size_t hlen, const char *n,
+                             size_t nlen)
+{
+    if (!nlen)
+        return h;
+    if (nlen > hlen)
+        return NULL;
+    if (nlen == 1)
+        return memchr(h, n[0], hlen);
+
+    size_t i = 0, starts = hlen - nlen + 1;
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(n[0]),
+                  last = _mm256_set1_epi8(n[nlen - 1]);
+    for (; i + 32 <= starts; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (h + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (h + i + nlen - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        for (; mask; mask &= mask - 1) {
+            size_t at = i + __builtin_ctz(mask);
+            if (!memcmp(h + at + 1, n + 1, nlen - 2))
+                return h + at;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(n[0]), last = _mm_set1_epi8(n[nlen - 1]);
+    for (; i + 16 <= starts; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (h + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (h + i + nlen - 1));
+        uint32_t mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        for (; mask; mask &= mask - 1) {
+            size_t at = i + __builtin_ctz(mask);
+            if (!memcmp(h + at + 1, n + 1, nlen - 2))
+                return h + at;
+        }
+    }
+#endif
+    for (; i < starts; i++)
+        if (h[i] == n[0] && !memcmp(h + i + 1, n + 1, nlen - 1))
+            return h + i;
+    return NULL;
+}
+
+/* first occurrence of needle in x, NULL if there is none */
+char *xs_find(const xs *x, const xs *needle)
+{
+    return (char *) xs_memmem(xs_data(x), xs_size(x), xs_data(needle),
+                              xs_size(needle));
+}
+
+/* Replace every non-overlapping occurrence of needle, scanning left to
+ * right. Matches are counted first, so the result is sized exactly and
+ * written once. Equal-length replacements are done in place.
+ */
+xs *xs_replace_all(xs *x, const xs *needle, const xs *repl)
+{
+    size_t nlen = xs_size(needle), rlen = xs_size(repl), size = xs_size(x);
+    const char *n = xs_data(needle), *r = xs_data(repl);
+    const char *data = xs_data(x), *end = data + size, *p;
+    size_t count = 0;
+
+    if (!nlen)
+        return x;
+    for (p = data; (p = xs_memmem(p, end - p, n, nlen)); p += nlen)
+        count++;
+    if (!count)
+        return x;
+
+    if (nlen == rlen) {
+        char *w = xs_make_writable(x), *wend = w + size;
+        /* needle may live in x itself, keep a copy before overwriting */
+        char nbuf[64], *ncopy = nlen <= sizeof(nbuf) ? nbuf : malloc(nlen);
+        memcpy(ncopy, n, nlen);
+        for (; (w = (char *) xs_memmem(w, wend - w, ncopy, nlen)); w += nlen)
+            memcpy(w, r, rlen);
+        if (ncopy != nbuf)
+            free(ncopy);
+        return x;
+    }
+
+    size_t newsize = size - count * nlen + count * rlen;
+    size_t bufsize = xs_alloc_size(newsize);
+    char inline_buf[16];
+    char *out = newsize <= 15 ? inline_buf : malloc(bufsize), *o = out;
+    const char *from = data;
+    for (p = data; (p = xs_memmem(p, end - p, n, nlen)); p += nlen) {
+        memcpy(o, from, p - from);
+        o += p - from;
+        memcpy(o, r, rlen);
+        o += rlen;
+        from = p + nlen;
+    }
+    memcpy(o, from, end - from);
+
+    bool epoch = xs_is_ptr(x) && x->flag2;
+    xs_free(x);
+    if (out == inline_buf)
+        return xs_new_len(x, out, newsize);
+    return xs_keep_epoch(xs_new_adopt(x, out, newsize, bufsize), epoch);
+}
+
+/* Compiled set of replacements applied together in one left-to-right scan,
+ * e.g. for escaping or templating. Rules are bucketed by their first byte
+ * and tried longest first, so at every position the longest pattern wins.
+ * Bytes that start no pattern are skipped with a byte-class lookup.
+ */
+struct xs_replace_rule {
+    const char *pat, *rep;
+    size_t plen, rlen;
+};
+
+typedef struct {
+    uint8_t start[32]; /* bytes that can begin a pattern */
+    uint32_t first[256], count[256];
+    struct xs_replace_rule *rules;
+    size_t nrules;
+} xs_replacer;
+
+static int xs_replace_rule_cmp(const void *a, const void *b)
+{
+    const struct xs_replace_rule *x = a, *y = b;
+    if ((uint8_t) x->pat[0] != (uint8_t) y->pat[0])
+        return (uint8_t) x->pat[0] - (uint8_t) y->pat[0];
+    return (x->plen < y->plen) - (x->plen > y->plen);
+}
+
+/* pairs holds n patterns each followed by its replacement; the strings are
+ * copied and empty patterns are ignored
+ */
+xs_replacer *xs_replacer_new(const char *const *pairs, size_t n)
+{
+    size_t i, bytes = 0;
+    for (i = 0; i < 2 * n; i++)
+        bytes += strlen(pairs[i]) + 1;
+
+    xs_replacer *t = calloc(1, sizeof(*t));
+    t->rules = malloc(n * sizeof(*t->rules) + bytes);
+    char *store = (char *) (t->rules + n);
+    for (i = 0; i < n; i++) {
+        struct xs_replace_rule *rule = &t->rules[t->nrules];
+        rule->plen = strlen(pairs[2 * i]);
+        rule->rlen = strlen(pairs[2 * i + 1]);
+        if (!rule->plen)
+            continue;
+        rule->pat = memcpy(store, pairs[2 * i], rule->plen + 1);
+        store += rule->plen + 1;
+        rule->rep = memcpy(store, pairs[2 * i + 1], rule->rlen + 1);
+        store += rule->rlen + 1;
+        t->nrules++;
+    }
+    qsort(t->rules, t->nrules, sizeof(*t->rules), xs_replace_rule_cmp);
+
+    for (i = t->nrules; i-- > 0;) {
+        uint8_t b = t->rules[i].pat[0];
+        t->start[b / 8] |= 1 << b % 8;
+        t->first[b] = i;
+        t->count[b]++;
+    }
+    return t;
+}
+
+void xs_replacer_free(xs_replacer *t)
+{
+    free(t->rules);
+    free(t);
+}
+
+static inline const struct xs_replace_rule *
+xs_replacer_match(const xs_replacer *t, const char *p, size_t left)
+{
+    uint8_t b = *p;
+    const struct xs_replace_rule *rule = t->rules + t->first[b];
+    for (uint32_t k = 0; k < t->count[b]; k++, rule++)
+        if (rule->plen <= left && !memcmp(p, rule->pat, rule->plen))
+            return rule;
+    return NULL;
+}
+
+/* Apply every rule of t to x. A first scan sizes the output exactly and a
+ * second one writes it, so x is allocated at most once; x is left alone
+ * when nothing matches.
+ */
+xs *xs_replace_many(xs *x, const xs_replacer *t)
+{
+    const char *data = xs_data(x), *end = data + xs_size(x), *p;
+    const struct xs_replace_rule *rule;
+    size_t newsize = 0, matches = 0;
+
+    for (p = data; p < end;) {
+        if (!xs_charset_has(t->start, *p) ||
+            !(rule = xs_replacer_match(t, p, end - p))) {
+            p++;
+            newsize++;
+            continue;
+        }
+        p += rule->plen;
+        newsize += rule->rlen;
+        matches++;
+    }
+    if (!matches)
+        return x;
+
+    size_t bufsize = xs_alloc_size(newsize);
+    char inline_buf[16];
+    char *out = newsize <= 15 ? inline_buf : malloc(bufsize), *o = out;
+    for (p = data; p < end;) {
+        const char *run = p;
+        while (p < end && !xs_charset_has(t->start, *p))
+            p++;
+        memcpy(o, run, p - run);
+        o += p - run;
+        if (p == end)
+            break;
+        if ((rule = xs_replacer_match(t, p, end - p))) {
+            memcpy(o, rule->rep, rule->rlen);
+            o += rule->rlen;
+            p += rule->plen;
+        } else
+            *o++ = *p++;
+    }
+
+    bool epoch = xs_is_ptr(x) && x->flag2;
+    xs_free(x);
+    if (out == inline_buf)
+        return xs_new_len(x, out, newsize);
+    return xs_keep_epoch(xs_new_adopt(x, out, newsize, bufsize), epoch);
+}
+
+/* extend x by n bytes and return where they go, the caller fills them in */
+static char *xs_append_reserve(xs *x, size_t n)
+{
+    size_t size = xs_size(x);
+    xs_make_writable(x);
+    if (size + n > xs_capacity(x))
+        xs_grow(x, size + n);
+    if (xs_is_ptr(x))
+        x->size = size + n;
+    else
+        x->space_left = 15 - (size + n);
+    char *data = xs_data(x);
+    data[size + n] = 0;
+    return data + size;
+}
+
+/* bit i is set when p[i] is a quote, a backslash or a control byte */
+static inline uint32_t xs_json_mask32(const char *p)
+{
+#if defined(__AVX2__)
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i ctl = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1f)),
+                                    _mm256_set1_epi8(0x1f));
+    __m256i q = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+    __m256i bs = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+    return _mm256_movemask_epi8(_mm256_or_si256(ctl, _mm256_or_si256(q, bs)));
+#elif defined(__SSE2__)
+    uint32_t mask = 0;
+    for (int half = 0; half < 2; half++) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + 16 * half));
+        __m128i ctl = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1f)),
+                                     _mm_set1_epi8(0x1f));
+        __m128i q = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+        __m128i bs = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+        mask |= (uint32_t) _mm_movemask_epi8(
+                    _mm_or_si128(ctl, _mm_or_si128(q, bs)))
+                << 16 * half;
+    }
+    return mask;
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i++)
+        if ((uint8_t) p[i] < 0x20 || p[i] == '"' || p[i] == '\\')
+            mask |= (uint32_t) 1 << i;
+    return mask;
+#endif
+}
+
+static inline bool xs_json_needs_escape(char c)
+{
+    return (uint8_t) c < 0x20 || c == '"' || c == '\\';
+}
+
+/* the second byte of a two-byte escape, 0 for \u00XX */
+static inline char xs_json_short_escape(char c)
+{
+    switch (c) {
+    case '"': return '"';
+    case '\\': return '\\';
+    case '\b': return 'b';
+    case '\f': return 'f';
+    case '\n': return 'n';
+    case '\r': return 'r';
+    case '\t': return 't';
+    }
+    return 0;
+}
+
+/* Append in to out escaped as the inside of a JSON string literal, without
+ * the surrounding quotes. Clean runs are found 32 bytes at a time and copied
+ * in bulk; out grows exactly once, by a size counted with the same masks.
+ * in and out must be different strings.
+ */
+xs *xs_json_escape_append(xs *out, const xs *in)
+{
+    const char *src = xs_data(in);
+    size_t len = xs_size(in), i, extra = 0;
+
+    for (i = 0; i + 32 <= len; i += 32)
+        for (uint32_t m = xs_json_mask32(src + i); m; m &= m - 1)
+            extra += xs_json_short_escape(src[i + __builtin_ctz(m)]) ? 1 : 5;
+    for (; i < len; i++)
+        if (xs_json_needs_escape(src[i]))
+            extra += xs_json_short_escape(src[i]) ? 1 : 5;
+
+    char *o = xs_append_reserve(out, len + extra);
+    if (!extra) {
+        memcpy(o, src, len);
+        return out;
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    size_t from = 0;
+    for (i = 0; i < len;) {
+        uint32_t m = i + 32 <= len ? xs_json_mask32(src + i) : 0;
+        size_t at;
+        if (i + 32 <= len) {
+            if (!m) {
+                i += 32;
+                continue;
+            }
+            at = i + __builtin_ctz(m);
+        } else {
+            for (at = i; at < len && !xs_json_needs_escape(src[at]); at++)
+                ;
+            if (at == len)
+                break;
+        }
+        memcpy(o, src + from, at - from);
+        o += at - from;
+        char c = src[at], e = xs_json_short_escape(c);
+        *o++ = '\\';
+        if (e)
+            *o++ = e;
+        else {
+            memcpy(o, "u00", 3);
+            o[3] = hex[(uint8_t) c >> 4];
+            o[4] = hex[c & 0xf];
+            o += 5;
+        }
+        from = i = at + 1;
+    }
+    memcpy(o, src + from, len - from);
+    return out;
+}
+
+static inline int xs_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static int32_t xs_json_u4(const char *p)
+{
+    int32_t v = 0;
+    for (int k = 0; k < 4; k++) {
+        int d = xs_hex_digit(p[k]);
+        if (d < 0)
+            return -1;
+        v = v << 4 | d;
+    }
+    return v;
+}
+
+/* Decode the inside of a JSON string literal into out, which may be in.
+ * Unescaped text never grows, so the output is sized by the input, and
+ * runs without a backslash are copied in bulk. Returns NULL and leaves out
+ * untouched when the escapes are malformed.
+ */
+xs *xs_json_unescape(xs *out, const xs *in)
+{
+    const char *p = xs_data(in), *end = p + xs_size(in);
+    size_t len = xs_size(in), bufsize = xs_alloc_size(len);
+    char inline_buf[16];
+    char *buf = len <= 15 ? inline_buf : malloc(bufsize), *o = buf;
+
+    for (;;) {
+        const char *bs = memchr(p, '\\', end - p);
+        size_t run = (bs ? bs : end) - p;
+        memcpy(o, p, run);
+        o += run;
+        if (!bs)
+            break;
+        p = bs + 1;
+        if (p == end)
+            goto bad;
+        char c = *p++;
+        switch (c) {
+        case '"': case '\\': case '/': *o++ = c; break;
+        case 'b': *o++ = '\b'; break;
+        case 'f': *o++ = '\f'; break;
+        case 'n': *o++ = '\n'; break;
+        case 'r': *o++ = '\r'; break;
+        case 't': *o++ = '\t'; break;
+        case 'u': {
+            int32_t cp = end - p >= 4 ? xs_json_u4(p) : -1;
+            if (cp < 0 || (cp >= 0xdc00 && cp <= 0xdfff))
+                goto bad;
+            p += 4;
+            if (cp >= 0xd800 && cp <= 0xdbff) {
+                int32_t lo = end - p >= 6 && p[0] == '\\' && p[1] == 'u'
+                                 ? xs_json_u4(p + 2)
+                                 : -1;
+                if (lo < 0xdc00 || lo > 0xdfff)
+                    goto bad;
+                p += 6;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+            }
+            if (cp < 0x80)
+                *o++ = cp;
+            else if (cp < 0x800) {
+                *o++ = 0xc0 | cp >> 6;
+                *o++ = 0x80 | (cp & 0x3f);
+            } else if (cp < 0x10000) {
+                *o++ = 0xe0 | cp >> 12;
+                *o++ = 0x80 | (cp >> 6 & 0x3f);
+                *o++ = 0x80 | (cp & 0x3f);
+            } else {
+                *o++ = 0xf0 | cp >> 18;
+                *o++ = 0x80 | (cp >> 12 & 0x3f);
+                *o++ = 0x80 | (cp >> 6 & 0x3f);
+                *o++ = 0x80 | (cp & 0x3f);
+            }
+            break;
+        }
+        default:
+            goto bad;
+        }
+    }
+
+    size_t size = o - buf;
+    bool epoch = xs_is_ptr(out) && out->flag2;
+    xs_free(out);
+    if (buf == inline_buf)
+        return xs_new_len(out, buf, size);
+    if (size <= 15) {
+        xs_new_len(out, buf, size);
+        free(buf);
+        return out;
+    }
+    return xs_keep_epoch(xs_new_adopt(out, buf, size, bufsize), epoch);
+
+bad:
+    if (buf != inline_buf)
+        free(buf);
+    return NULL;
+}
+
+/* shrink x back to n bytes, used to undo a reservation */
+static inline void xs_truncate(xs *x, size_t n)
+{
+    if (xs_is_ptr(x))
+        x->size = n;
+    else
+        x->space_left = 15 - n;
+    xs_data(x)[n] = 0;
+}
+
+static const char xs_b64_std[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char xs_b64_url[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+#ifdef __SSSE3__
+/* 12 input bytes to 16 base64 characters in one register */
+static inline __m128i xs_b64_encode16(__m128i in, bool url)
+{
+    /* spread every 3 bytes over 4 lanes, then cut out the 6-bit fields */
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3,
+                                           4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i idx = _mm_or_si128(t1, t3);
+
+    /* map each 6-bit value to the offset that turns it into its letter */
+    __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    __m128i lt = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+    r = _mm_or_si128(r, _mm_and_si128(lt, _mm_set1_epi8(13)));
+    const __m128i shift = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, (url ? '-' : '+') - 62,
+        (url ? '_' : '/') - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, r), idx);
+}
+#endif
+
+/* Append in as base64. The standard alphabet pads with '=', the URL-safe
+ * one does not. The output is sized exactly before anything is written.
+ */
+xs *xs_base64_encode_append(xs *out, xs_view in, bool url)
+{
+    const uint8_t *p = (const uint8_t *) in.ptr;
+    size_t len = in.len, i = 0;
+    size_t outlen = url ? (len * 4 + 2) / 3 : (len + 2) / 3 * 4;
+    const char *alpha = url ? xs_b64_url : xs_b64_std;
+    char *o = xs_append_reserve(out, outlen);
+
+#ifdef __SSSE3__
+    /* every load reads 16 bytes but only consumes 12 */
+    for (; i + 16 <= len; i += 12, o += 16)
+        _mm_storeu_si128((__m128i *) o,
+                         xs_b64_encode16(
+                             _mm_loadu_si128((const __m128i *) (p + i)), url));
+#endif
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = p[i] << 16 | p[i + 1] << 8 | p[i + 2];
+        *o++ = alpha[v >> 18];
+        *o++ = alpha[v >> 12 & 63];
+        *o++ = alpha[v >> 6 & 63];
+        *o++ = alpha[v & 63];
+    }
+    if (i < len) {
+        uint32_t v = p[i] << 16 | (i + 1 < len ? p[i + 1] << 8 : 0);
+        *o++ = alpha[v >> 18];
+        *o++ = alpha[v >> 12 & 63];
+        if (i + 1 < len)
+            *o++ = alpha[v >> 6 & 63];
+        else if (!url)
+            *o++ = '=';
+        if (!url)
+            *o++ = '=';
+    }
+    return out;
+}
+
+static inline int xs_b64_value(char c, bool url)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == (url ? '-' : '+'))
+        return 62;
+    if (c == (url ? '_' : '/'))
+        return 63;
+    return -1;
+}
+
+/* Append the bytes encoded by in, with or without '=' padding in either
+ * alphabet. Returns NULL and leaves out as it was on malformed input.
+ */
+xs *xs_base64_decode_append(xs *out, xs_view in, bool url)
+{
+    size_t len = in.len;
+    while (len && in.ptr[len - 1] == '=' && in.len - len < 2)
+        len--;
+    size_t pad = in.len - len;
+    if (len % 4 == 1 || (pad && in.len % 4))
+        return NULL;
+
+    size_t old = xs_size(out), outlen = len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+    char *o = xs_append_reserve(out, outlen);
+    const char *p = in.ptr;
+    size_t i;
+    for (i = 0; i + 4 <= len; i += 4) {
+        int a = xs_b64_value(p[i], url), b = xs_b64_value(p[i + 1], url),
+            c = xs_b64_value(p[i + 2], url), d = xs_b64_value(p[i + 3], url);
+        if ((a | b | c | d) < 0)
+            goto bad;
+        uint32_t v = a << 18 | b << 12 | c << 6 | d;
+        *o++ = v >> 16;
+        *o++ = v >> 8;
+        *o++ = v;
+    }
+    if (i < len) {
+        int a = xs_b64_value(p[i], url), b = xs_b64_value(p[i + 1], url),
+            c = i + 2 < len ? xs_b64_value(p[i + 2], url) : 0;
+        if ((a | b | c) < 0)
+            goto bad;
+        uint32_t v = a << 18 | b << 12 | c << 6;
+        *o++ = v >> 16;
+        if (i + 2 < len)
+            *o++ = v >> 8;
+    }
+    return out;
+
+bad:
+    xs_truncate(out, old);
+    return NULL;
+}
+
+/* append in as lowercase hex, two characters per byte */
+xs *xs_hex_encode_append(xs *out, xs_view in)
+{
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *p = (const uint8_t *) in.ptr;
+    size_t i = 0;
+    char *o = xs_append_reserve(out, in.len * 2);
+
+#ifdef __SSSE3__
+    const __m128i lut = _mm_loadu_si128((const __m128i *) hex),
+                  low = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= in.len; i += 16, o += 32) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), low));
+        __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, low));
+        _mm_storeu_si128((__m128i *) o, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (o + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+    for (; i < in.len; i++) {
+        *o++ = hex[p[i] >> 4];
+        *o++ = hex[p[i] & 15];
+    }
+    return out;
+}
+
+/* either case is accepted; NULL with out unchanged on malformed input */
+xs *xs_hex_decode_append(xs *out, xs_view in)
+{
+    if (in.len % 2)
+        return NULL;
+    size_t old = xs_size(out);
+    char *o = xs_append_reserve(out, in.len / 2);
+    for (size_t i = 0; i < in.len; i += 2) {
+        int hi = xs_hex_digit(in.ptr[i]), lo = xs_hex_digit(in.ptr[i + 1]);
+        if ((hi | lo) < 0) {
+            xs_truncate(out, old);
+            return NULL;
+        }
+        *o++ = hi << 4 | lo;
+    }
+    return out;
+}
+
+/* URL percent-encoding. Unreserved bytes (RFC 3986: letters, digits and
+ * "-._~") pass through, everything else becomes %XX. With plus set, space
+ * and '+' follow the form encoding rules instead.
+ */
+static inline bool xs_url_safe(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+           c == '~';
+}
+
+#ifdef __SSE2__
+/* bit i is set when p[i] is not unreserved; bytes >= 0x80 are negative as
+ * signed chars, so they fall outside every range below
+ */
+static inline uint32_t xs_url_unsafe16(const char *p)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+#define in_range(lo, hi)                                  \
+    _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), \
+                  _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)))
+    __m128i safe = _mm_or_si128(
+        _mm_or_si128(in_range('a', 'z'), in_range('A', 'Z')),
+        _mm_or_si128(in_range('0', '9'), in_range('-', '.')));
+#undef in_range
+    safe = _mm_or_si128(safe, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    safe = _mm_or_si128(safe, _mm_cmpeq_epi8(v, _mm_set1_epi8('~')));
+    return ~_mm_movemask_epi8(safe) & 0xffff;
+}
+#endif
+
+/* length of the leading run of unreserved bytes */
+static size_t xs_url_safe_span(const char *p, size_t len)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        uint32_t m = xs_url_unsafe16(p + i);
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+#endif
+    while (i < len && xs_url_safe(p[i]))
+        i++;
+    return i;
+}
+
+xs *xs_url_encode_append(xs *out, xs_view in, bool plus)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const char *p = in.ptr, *end = p + in.len;
+    size_t unsafe = 0, i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= in.len; i += 16)
+        unsafe += __builtin_popcount(xs_url_unsafe16(p + i));
+#endif
+    for (; i < in.len; i++)
+        unsafe += !xs_url_safe(p[i]);
+    if (plus)
+        for (const char *sp = p; (sp = memchr(sp, ' ', end - sp)); sp++)
+            unsafe--; /* one byte instead of three, counted as 1 - 2 */
+
+    char *o = xs_append_reserve(out, in.len + 2 * unsafe);
+    while (p < end) {
+        size_t run = xs_url_safe_span(p, end - p);
+        memcpy(o, p, run);
+        o += run;
+        p += run;
+        if (p == end)
+            break;
+        uint8_t c = *p++;
+        if (plus && c == ' ')
+            *o++ = '+';
+        else {
+            *o++ = '%';
+            *o++ = hex[c >> 4];
+            *o++ = hex[c & 15];
+        }
+    }
+    return out;
+}
+
+/* hex digit value plus one, 0 for anything else */
+static const uint8_t xs_hexval1[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,
+    ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10, ['A'] = 11, ['B'] = 12,
+    ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16, ['a'] = 11, ['b'] = 12,
+    ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+};
+
+/* Decode in place: the result is never longer than the input. Nothing is
+ * written, and a shared buffer is not even detached, when there is no
+ * escape at all. A '%' not followed by two hex digits is kept as it is.
+ */
+xs *xs_url_decode(xs *x, bool plus)
+{
+    size_t len = xs_size(x);
+    const char *data = xs_data(x);
+    const char *first = memchr(data, '%', len);
+    if (plus) {
+        const char *sp = memchr(data, '+', first ? (size_t) (first - data) : len);
+        if (sp)
+            first = sp;
+    }
+    if (!first)
+        return x;
+
+    size_t at = first - data;
+    char *w = xs_make_writable(x), *r = w + at, *end = w + len;
+    w = r;
+    while (r < end) {
+        char *esc = memchr(r, '%', end - r);
+        char *stop = esc ? esc : end;
+        if (plus)
+            for (char *q = r; q < stop; q++)
+                if (*q == '+')
+                    *q = ' ';
+        memmove(w, r, stop - r);
+        w += stop - r;
+        r = stop;
+        if (!esc)
+            break;
+        uint8_t hi = end - r > 2 ? xs_hexval1[(uint8_t) r[1]] : 0,
+                lo = end - r > 2 ? xs_hexval1[(uint8_t) r[2]] : 0;
+        if (hi && lo) {
+            *w++ = (hi - 1) << 4 | (lo - 1);
+            r += 3;
+        } else
+            *w++ = *r++;
+    }
+    xs_truncate(x, w - xs_data(x));
+    return x;
+}
+
+static size_t xs_count_char_len(const char *p, size_t len, char c)
+{
+    size_t i = 0, n = 0;
+#if defined(__AVX2__)
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; i + 32 <= len; i += 32)
+        n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) (p + i)), needle)));
+#elif defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; i + 16 <= len; i += 16)
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *) (p + i)), needle)));
+#endif
+    for (; i < len; i++)
+        n += p[i] == c;
+    return n;
+}
+
+/* number of bytes equal to c */
+size_t xs_count_char(const xs *x, char c)
+{
+    return xs_count_char_len(xs_data(x), xs_size(x), c);
+}
+
+/* Number of bytes that appear in charset. With SSSE3 any set is tested 16
+ * bytes at a time: the low nibble of a byte picks which high nibbles are
+ * members from one table, the high nibble picks its bit from another.
+ */
+size_t xs_count_any(const xs *x, const char *charset)
+{
+    const char *p = xs_data(x);
+    size_t len = xs_size(x), i = 0, n = 0;
+    uint8_t set[32];
+    xs_charset_init(set, charset);
+
+#ifdef __SSSE3__
+    uint8_t lo_rows[2][16] = {{0}};
+    for (int b = 0; b < 256; b++)
+        if (set[b / 8] & 1 << b % 8)
+            lo_rows[b >> 7][b & 15] |= 1 << (b >> 4 & 7);
+    const __m128i lut0 = _mm_loadu_si128((const __m128i *) lo_rows[0]),
+                  lut1 = _mm_loadu_si128((const __m128i *) lo_rows[1]),
+                  bit0 = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0,
+                                       0, 0, 0, 0, 0),
+                  bit1 = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16,
+                                       32, 64, -128),
+                  nib = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i lo = _mm_and_si128(v, nib),
+                hi = _mm_and_si128(_mm_srli_epi16(v, 4), nib);
+        __m128i hit = _mm_or_si128(
+            _mm_and_si128(_mm_shuffle_epi8(lut0, lo), _mm_shuffle_epi8(bit0, hi)),
+            _mm_and_si128(_mm_shuffle_epi8(lut1, lo), _mm_shuffle_epi8(bit1, hi)));
+        n += 16 - __builtin_popcount(_mm_movemask_epi8(
+                      _mm_cmpeq_epi8(hit, _mm_setzero_si128())));
+    }
+#endif
+    for (; i < len; i++)
+        n += xs_charset_has(set, p[i]);
+    return n;
+}
+
+/* Byte frequencies of x, added to hist. Consecutive bytes go to four
+ * separate tables, so runs of the same byte do not keep waiting on the
+ * store of the previous increment; the 32-bit counters are folded into
+ * hist before they could overflow.
+ */
+void xs_byte_histogram(const xs *x, uint64_t hist[256])
+{
+    const uint8_t *p = (const uint8_t *) xs_data(x);
+    size_t len = xs_size(x);
+    uint32_t sub[4][256];
+
+    while (len) {
+        size_t chunk = len < ((size_t) 1 << 30) ? len : (size_t) 1 << 30, i;
+        memset(sub, 0, sizeof(sub));
+        for (i = 0; i + 4 <= chunk; i += 4) {
+            sub[0][p[i]]++;
+            sub[1][p[i + 1]]++;
+            sub[2][p[i + 2]]++;
+            sub[3][p[i + 3]]++;
+        }
+        for (; i < chunk; i++)
+            sub[0][p[i]]++;
+        for (int b = 0; b < 256; b++)
+            hist[b] += (uint64_t) sub[0][b] + sub[1][b] + sub[2][b] + sub[3][b];
+        p += chunk;
+        len -= chunk;
+    }
+}
+
+/* CSV/TSV records as views into the input, in the style of simdcsv. Input
+ * is classified 64 bytes at a time into bitmaps of quotes and of
+ * delimiters/newlines. A prefix XOR of the quote bits (a carry-less
+ * multiply by all ones) marks the quoted regions, carried from block to
+ * block, and clearing those from the delimiter bits leaves exactly the
+ * field boundaries. The input only has to be contiguous, so an mmap'd
+ * file of any size works as well as an xs.
+ */
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t block, next_block; /* offset of the loaded and the next block */
+    uint64_t bits;            /* field boundaries left in the loaded block */
+    uint64_t inquote;         /* all ones if the next block starts quoted */
+    size_t start;             /* where the next field begins */
+    char delim;
+} xs_csv_parser;
+
+void xs_csv_init(xs_csv_parser *p, const char *data, size_t len, char delim)
+{
+    memset(p, 0, sizeof(*p));
+    p->data = data;
+    p->len = len;
+    p->delim = delim;
+}
+
+static inline uint64_t xs_prefix_xor(uint64_t bits)
+{
+#ifdef __PCLMUL__
+    return _mm_cvtsi128_si64(_mm_clmulepi64_si128(
+        _mm_set_epi64x(0, bits), _mm_set1_epi8((char) 0xff), 0));
+#else
+    for (int shift = 1; shift < 64; shift <<= 1)
+        bits ^= bits << shift;
+    return bits;
+#endif
+}
+
+static void xs_csv_load(xs_csv_parser *p)
+{
+    const char *blk = p->data + p->next_block;
+    char tail[64];
+    if (p->len - p->next_block < 64) {
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, blk, p->len - p->next_block);
+        blk = tail;
+    }
+
+    uint64_t quote = 0, sep = 0;
+#ifdef __SSE2__
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (blk + 16 * k));
+        quote |= (uint64_t) _mm_movemask_epi8(
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('"')))
+                 << 16 * k;
+        sep |= (uint64_t) _mm_movemask_epi8(_mm_or_si128(
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8(p->delim)),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))))
+               << 16 * k;
+    }
+#else
+    for (int k = 0; k < 64; k++) {
+        quote |= (uint64_t) (blk[k] == '"') << k;
+        sep |= (uint64_t) (blk[k] == p->delim || blk[k] == '\n') << k;
+    }
+#endif
+    uint64_t inside = xs_prefix_xor(quote) ^ p->inquote;
+    p->inquote = (uint64_t) ((int64_t) inside >> 63);
+    p->bits = sep & ~inside;
+    p->block = p->next_block;
+    p->next_block += 64;
+}
+
+/* offset of the next field boundary, or len once the input runs out */
+static size_t xs_csv_boundary(xs_csv_parser *p)
+{
+    while (!p->bits) {
+        if (p->next_block >= p->len)
+            return p->len;
+        xs_csv_load(p);
+    }
+    size_t at = p->block + __builtin_ctzll(p->bits);
+    p->bits &= p->bits - 1;
+    return at < p->len ? at : p->len;
+}
+
+/* Views of the fields of the next record go to fields, up to max of them;
+ * returns how many the record has, 0 at the end of the input. Quoted
+ * fields come without their outer quotes but with any "" still doubled,
+ * see xs_csv_unescape. A "\r\n" line ending is accepted.
+ */
+size_t xs_csv_next(xs_csv_parser *p, xs_view *fields, size_t max)
+{
+    size_t n = 0;
+    if (p->start >= p->len)
+        return 0;
+    for (;;) {
+        size_t at = xs_csv_boundary(p);
+        const char *f = p->data + p->start;
+        size_t flen = at - p->start;
+        bool eol = at == p->len || p->data[at] == '\n';
+        if (eol && flen && f[flen - 1] == '\r')
+            flen--;
+        if (flen >= 2 && f[0] == '"' && f[flen - 1] == '"') {
+            f++;
+            flen -= 2;
+        }
+        if (n < max)
+            fields[n] = (xs_view){f, flen};
+        n++;
+        p->start = at + 1;
+        if (eol)
+            return n;
+    }
+}
+
+/* copy a field into out, collapsing "" only if the field has any quote.
+ * f may be a view into out itself, so out is only released at the end.
+ */
+xs *xs_csv_unescape(xs *out, xs_view f)
+{
+    const char *q = memchr(f.ptr, '"', f.len);
+    xs tmp;
+    if (!q) {
+        xs_new_len(&tmp, f.ptr, f.len);
+    } else {
+        char *o = xs_append_reserve(xs_newempty(&tmp), f.len), *start = o;
+        const char *p = f.ptr, *end = f.ptr + f.len;
+        while (q) {
+            memcpy(o, p, q - p + 1);
+            o += q - p + 1;
+            p = q + 1 < end && q[1] == '"' ? q + 2 : q + 1;
+            q = memchr(p, '"', end - p);
+        }
+        memcpy(o, p, end - p);
+        o += end - p;
+        xs_truncate(&tmp, o - start);
+    }
+    xs_free(out);
+    *out = tmp;
+    return out;
+}
+
+/* Work-stealing executor. Tasks 0..n-1 are dealt out to the workers as
+ * contiguous ranges; a worker takes tasks from the front of its own range
+ * and, once that is empty, steals the back half of another worker's range.
+ * A range is packed into one 64-bit word so both ends move with a single
+ * compare-and-swap. Worker threads are started on first use and then kept
+ * waiting for the next job, so a call only pays for waking them up; jobs
+ * from different threads run one after another, and a task that starts a
+ * job of its own runs it serially. xs_par_shutdown stops the workers.
+ */
+#define XS_PAR_MAX_THREADS 256
+
+struct xs_par_worker {
+    uint64_t range; /* first task << 32 | end */
+    char pad[64 - sizeof(uint64_t)];
+};
+
+struct xs_par_job {
+    struct xs_par_worker *workers;
+    int nthreads;
+    void (*task)(void *arg, size_t i);
+    void *arg;
+};
+
+static struct {
+    pthread_mutex_t run;  /* one job at a time */
+    pthread_mutex_t lock; /* everything below */
+    pthread_cond_t wake, done;
+    pthread_t threads[XS_PAR_MAX_THREADS];
+    int nstarted;         /* workers 1..nstarted are running */
+    uint64_t generation;  /* bumped for every job */
+    struct xs_par_job *job;
+    int busy;             /* workers still on the current job */
+    bool stop;
+} xs_par_pool = {.run = PTHREAD_MUTEX_INITIALIZER,
+                 .lock = PTHREAD_MUTEX_INITIALIZER,
+                 .wake = PTHREAD_COND_INITIALIZER,
+                 .done = PTHREAD_COND_INITIALIZER};
+
+/* set while a thread runs tasks, nested jobs then run serially */
+static __thread bool xs_par_in_task;
+
+static bool xs_par_take(struct xs_par_worker *w, size_t *task)
+{
+    uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t lo = r >> 32, hi = (uint32_t) r;
+        if (lo >= hi)
+            return false;
+        if (__atomic_compare_exchange_n(&w->range, &r,
+                                        (uint64_t) (lo + 1) << 32 | hi, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *task = lo;
+            return true;
+        }
+    }
+}
+
+/* move the back half of victim's range into thief's, which is empty */
+static bool xs_par_steal(struct xs_par_worker *thief,
+                         struct xs_par_worker *victim)
+{
+    uint64_t r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t lo = r >> 32, hi = (uint32_t) r;
+        if (lo >= hi)
+            return false;
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (__atomic_compare_exchange_n(&victim->range, &r,
+                                        (uint64_t) lo << 32 | mid, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&thief->range, (uint64_t) mid << 32 | hi,
+                             __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+}
+
+static void xs_par_work(struct xs_par_job *job, int id)
+{
+    struct xs_par_worker *mine = &job->workers[id];
+    size_t task;
+
+    for (;;) {
+        while (xs_par_take(mine, &task))
+            job->task(job->arg, task);
+        bool stole = false;
+        for (int k = 1; k < job->nthreads && !stole; k++)
+            stole = xs_par_steal(
+                mine, &job->workers[(id + k) % job->nthreads]);
+        if (!stole)
+            return;
+    }
+}
+
+static void *xs_par_thread_main(void *arg)
+{
+    int id = (int) (intptr_t) arg;
+    /* started right before a job is posted, which is the first one seen */
+    uint64_t seen = 0;
+
+    xs_par_in_task = true;
+    pthread_mutex_lock(&xs_par_pool.lock);
+    for (;;) {
+        while (!xs_par_pool.stop && xs_par_pool.generation == seen)
+            pthread_cond_wait(&xs_par_pool.wake, &xs_par_pool.lock);
+        if (xs_par_pool.stop)
+            break;
+        seen = xs_par_pool.generation;
+        struct xs_par_job *job = xs_par_pool.job;
+        if (id >= job->nthreads)
+            continue;
+        pthread_mutex_unlock(&xs_par_pool.lock);
+        xs_par_work(job, id);
+        pthread_mutex_lock(&xs_par_pool.lock);
+        if (!--xs_par_pool.busy)
+            pthread_cond_signal(&xs_par_pool.done);
+    }
+    pthread_mutex_unlock(&xs_par_pool.lock);
+    return NULL;
+}
+
+/* run task(arg, i) for every i < ntasks on up to nthreads threads, the
+ * calling thread included; returns once all tasks are done
+ */
+void xs_par_run(size_t ntasks, int nthreads, void (*task)(void *, size_t),
+                void *arg)
+{
+    if (nthreads > XS_PAR_MAX_THREADS)
+        nthreads = XS_PAR_MAX_THREADS;
+    if ((size_t) nthreads > ntasks)
+        nthreads = ntasks;
+    if (nthreads <= 1 || ntasks > UINT32_MAX || xs_par_in_task) {
+        for (size_t i = 0; i < ntasks; i++)
+            task(arg, i);
+        return;
+    }
+
+    pthread_mutex_lock(&xs_par_pool.run);
+    pthread_mutex_lock(&xs_par_pool.lock);
+    /* threads that fail to start just leave fewer workers */
+    while (xs_par_pool.nstarted < nthreads - 1) {
+        int id = xs_par_pool.nstarted + 1;
+        if (pthread_create(&xs_par_pool.threads[id], NULL, xs_par_thread_main,
+                           (void *) (intptr_t) id))
+            break;
+        xs_par_pool.nstarted++;
+    }
+    if (nthreads > xs_par_pool.nstarted + 1)
+        nthreads = xs_par_pool.nstarted + 1;
+
+    struct xs_par_worker *workers =
+        aligned_alloc(64, nthreads * sizeof(*workers));
+    struct xs_par_job job = {workers, nthreads, task, arg};
+    for (int t = 0; t < nthreads; t++) {
+        uint64_t lo = ntasks * t / nthreads, hi = ntasks * (t + 1) / nthreads;
+        workers[t].range = lo << 32 | hi;
+    }
+    xs_par_pool.job = &job;
+    xs_par_pool.busy = nthreads - 1;
+    xs_par_pool.generation++;
+    pthread_cond_broadcast(&xs_par_pool.wake);
+    pthread_mutex_unlock(&xs_par_pool.lock);
+
+    xs_par_in_task = true;
+    xs_par_work(&job, 0);
+    xs_par_in_task = false;
+
+    pthread_mutex_lock(&xs_par_pool.lock);
+    while (xs_par_pool.busy)
+        pthread_cond_wait(&xs_par_pool.done, &xs_par_pool.lock);
+    pthread_mutex_unlock(&xs_par_pool.lock);
+    pthread_mutex_unlock(&xs_par_pool.run);
+    free(workers);
+}
+
+/* stop and join the pool's threads, the next job starts new ones */
+void xs_par_shutdown(void)
+{
+    pthread_mutex_lock(&xs_par_pool.run);
+    pthread_mutex_lock(&xs_par_pool.lock);
+    xs_par_pool.stop = true;
+    pthread_cond_broadcast(&xs_par_pool.wake);
+    pthread_mutex_unlock(&xs_par_pool.lock);
+    for (int t = 1; t <= xs_par_pool.nstarted; t++)
+        pthread_join(xs_par_pool.threads[t], NULL);
+    xs_par_pool.nstarted = 0;
+    xs_par_pool.stop = false;
+    pthread_mutex_unlock(&xs_par_pool.run);
+}
+
+/* Parallel scans over one large string. The buffer is cut into chunks of
+ * about chunk bytes, each cut moved forward to a safe boundary: just past
+ * the next delim byte, or with delim < 0 to the next UTF-8 sequence start.
+ * kernel(arg, i, p, len) runs on chunk i; results kept per chunk index can
+ * then be merged in order by the caller.
+ */
+struct xs_par_chunks {
+    const char *data;
+    size_t *cuts; /* chunk i is [cuts[i], cuts[i + 1]) */
+    void (*kernel)(void *, size_t, const char *, size_t);
+    void *arg;
+};
+
+static void xs_par_chunk_task(void *arg, size_t i)
+{
+    struct xs_par_chunks *c = arg;
+    c->kernel(c->arg, i, c->data + c->cuts[i], c->cuts[i + 1] - c->cuts[i]);
+}
+
+/* returns the number of chunks, which the kernel saw as indices */
+size_t xs_par_chunked(const xs *x, size_t chunk, int delim, int nthreads,
+                      void (*kernel)(void *, size_t, const char *, size_t),
+                      void *arg)
+{
+    const char *data = xs_data(x);
+    size_t len = xs_size(x), n = 0;
+    if (!chunk)
+        chunk = 1;
+    size_t *cuts = malloc((len / chunk + 2) * sizeof(*cuts));
+
+    cuts[n++] = 0;
+    for (size_t at = chunk; at < len; at += chunk) {
+        if (delim >= 0) {
+            const char *d = memchr(data + at, delim, len - at);
+            at = d ? (size_t) (d - data) + 1 : len;
+        } else
+            while (at < len && ((uint8_t) data[at] & 0xc0) == 0x80)
+                at++;
+        if (at >= len)
+            break;
+        cuts[n++] = at;
+    }
+    cuts[n] = len;
+
+    struct xs_par_chunks c = {data, cuts, kernel, arg};
+    xs_par_run(n, nthreads, xs_par_chunk_task, &c);
+    free(cuts);
+    return n;
+}
+
+struct xs_par_count {
+    char c;
+    size_t *counts;
+};
+
+static void xs_par_count_kernel(void *arg, size_t i, const char *p, size_t len)
+{
+    struct xs_par_count *pc = arg;
+    pc->counts[i] = xs_count_char_len(p, len, pc->c);
+}
+
+/* xs_count_char spread over nthreads threads */
+size_t xs_par_count_char(const xs *x, char c, int nthreads)
+{
+    size_t chunk = (size_t) 1 << 22;
+    size_t *counts = malloc((xs_size(x) / chunk + 2) * sizeof(*counts));
+    struct xs_par_count pc = {c, counts};
+    size_t n = xs_par_chunked(x, chunk, -1, nthreads, xs_par_count_kernel, &pc),
+           total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += counts[i];
+    free(counts);
+    return total;
+}
+
+struct xs_par_lines {
+    const char *data;
+    size_t **starts, *nstarts;
+};
+
+static void xs_par_lines_kernel(void *arg, size_t i, const char *p, size_t len)
+{
+    struct xs_par_lines *pl = arg;
+    size_t n = xs_count_char_len(p, len, '\n'), k = 0;
+    size_t *out = pl->starts[i] = malloc((n + 1) * sizeof(*out));
+    for (const char *q = p, *end = p + len; (q = memchr(q, '\n', end - q));)
+        out[k++] = ++q - pl->data;
+    pl->nstarts[i] = k;
+}
+
+/* Offsets of every line start after the first (i.e. one past each '\n'),
+ * in order, stored in *starts; returns how many there are. Chunks are cut
+ * at newlines and indexed in parallel, then concatenated in chunk order.
+ */
+size_t xs_par_line_index(const xs *x, size_t **starts, int nthreads)
+{
+    size_t chunk = (size_t) 1 << 22, max = xs_size(x) / chunk + 2;
+    struct xs_par_lines pl = {xs_data(x), malloc(max * sizeof(size_t *)),
+                              malloc(max * sizeof(size_t))};
+    size_t n = xs_par_chunked(x, chunk, '\n', nthreads, xs_par_lines_kernel,
+                              &pl),
+           total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += pl.nstarts[i];
+
+    size_t *out = *starts = malloc((total + 1) * sizeof(*out));
+    for (size_t i = 0; i < n; i++) {
+        memcpy(out, pl.starts[i], pl.nstarts[i] * sizeof(*out));
+        out += pl.nstarts[i];
+        free(pl.starts[i]);
+    }
+    free(pl.starts);
+    free(pl.nstarts);
+    return total;
+}
+
+struct xs_par_find {
+    const char *data, *needle;
+    size_t len, nlen;
+    size_t **pos, *npos;
+};
+
+/* matches may start anywhere in the chunk and run past its end */
+static void xs_par_find_kernel(void *arg, size_t i, const char *p, size_t len)
+{
+    struct xs_par_find *pf = arg;
+    size_t start = p - pf->data, cap = 16, k = 0;
+    size_t scan = pf->len - start < len + pf->nlen - 1 ? pf->len - start
+                                                        : len + pf->nlen - 1;
+    size_t *out = malloc(cap * sizeof(*out));
+    for (const char *q = p, *end = p + scan;
+         (q = xs_memmem(q, end - q, pf->needle, pf->nlen)) && q < p + len;
+         q++) {
+        if (k == cap)
+            out = realloc(out, (cap *= 2) * sizeof(*out));
+        out[k++] = q - pf->data;
+    }
+    pf->pos[i] = out;
+    pf->npos[i] = k;
+}
+
+/* Offsets of every occurrence of needle in x, overlapping ones included,
+ * in order, stored in *pos; returns how many there are. Each chunk reports
+ * the matches starting in it, reading past its end as far as one needle.
+ */
+size_t xs_par_find_all(const xs *x, const xs *needle, size_t **pos,
+                       int nthreads)
+{
+    size_t chunk = (size_t) 1 << 22, max = xs_size(x) / chunk + 2, total = 0;
+    struct xs_par_find pf = {xs_data(x), xs_data(needle), xs_size(x),
+                             xs_size(needle), malloc(max * sizeof(size_t *)),
+                             malloc(max * sizeof(size_t))};
+    size_t n = pf.nlen ? xs_par_chunked(x, chunk, -1, nthreads,
+                                        xs_par_find_kernel, &pf)
+                       : 0;
+    for (size_t i = 0; i < n; i++)
+        total += pf.npos[i];
+
+    size_t *out = *pos = malloc((total + 1) * sizeof(*out));
+    for (size_t i = 0; i < n; i++) {
+        memcpy(out, pf.pos[i], pf.npos[i] * sizeof(*out));
+        out += pf.npos[i];
+        free(pf.pos[i]);
+    }
+    free(pf.pos);
+    free(pf.npos);
+    return total;
+}
+
+/* decode one UTF-8 sequence, returns its length or 0 when malformed */
+static size_t xs_utf8_decode(const uint8_t *p, size_t left, uint32_t *cp)
+{
+    static const uint32_t min[] = {0, 0, 0x80, 0x800, 0x10000};
+    size_t n = p[0] < 0x80 ? 1 : p[0] < 0xc0 ? 0 : p[0] < 0xe0 ? 2 :
+               p[0] < 0xf0 ? 3 : p[0] < 0xf8 ? 4 : 0;
+    if (!n || n > left)
+        return 0;
+    uint32_t c = n == 1 ? p[0] : p[0] & (0x7f >> n);
+    for (size_t i = 1; i < n; i++) {
+        if ((p[i] & 0xc0) != 0x80)
+            return 0;
+        c = c << 6 | (p[i] & 0x3f);
+    }
+    if (c < min[n] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+        return 0;
+    *cp = c;
+    return n;
+}
+
+static void xs_par_utf8_kernel(void *arg, size_t i, const char *p, size_t len)
+{
+    bool *valid = arg;
+    const uint8_t *s = (const uint8_t *) p, *end = s + len;
+    uint32_t cp;
+
+    valid[i] = false;
+    while (s < end) {
+        uint64_t w;
+        if (end - s >= 8 && (memcpy(&w, s, 8), !(w & 0x8080808080808080ULL))) {
+            s += 8;
+            continue;
+        }
+        size_t n = xs_utf8_decode(s, end - s, &cp);
+        if (!n)
+            return;
+        s += n;
+    }
+    valid[i] = true;
+}
+
+/* Whether x is well-formed UTF-8. Chunks are cut at sequence starts, so no
+ * valid sequence is split and each chunk is checked on its own.
+ */
+bool xs_par_utf8_valid(const xs *x, int nthreads)
+{
+    size_t chunk = (size_t) 1 << 22, max = xs_size(x) / chunk + 2;
+    bool *valid = malloc(max * sizeof(*valid)), ok = true;
+    size_t n = xs_par_chunked(x, chunk, -1, nthreads, xs_par_utf8_kernel,
+                              valid);
+    for (size_t i = 0; i < n && ok; i++)
+        ok = valid[i];
+    free(valid);
+    return ok;
+}
+
+/* ASCII lowercase in place */
+xs *xs_tolower(xs *x)
+{
+    char *p = xs_data(x), *end = p + xs_size(x);
+    for (; p < end; p++)
+        if (*p >= 'A' && *p <= 'Z')
+            break;
+    if (p == end)
+        return x;
+    size_t at = p - xs_data(x);
+    p = xs_make_writable(x) + at;
+    end = xs_data(x) + xs_size(x);
+    for (; p < end; p++)
+        if (*p >= 'A' && *p <= 'Z')
+            *p += 'a' - 'A';
+    return x;
+}
+
+/* Apply op(&arr[i], i, arg) to every string of an array. The array is
+ * processed in blocks that fit in L1 together with their data, one block
+ * per task on up to nthreads threads, and the heap buffers of strings a few
+ * positions ahead are prefetched so op rarely waits on a cache miss.
+ */
+#define XS_BATCH_BLOCK 256
+#define XS_BATCH_PREFETCH 8
+
+struct xs_batch {
+    xs *arr;
+    size_t n;
+    void (*op)(xs *, size_t, void *);
+    void *arg;
+};
+
+static void xs_batch_block(void *arg, size_t b)
+{
+    struct xs_batch *batch = arg;
+    size_t lo = b * XS_BATCH_BLOCK, hi = lo + XS_BATCH_BLOCK;
+    if (hi > batch->n)
+        hi = batch->n;
+    for (size_t i = lo; i < hi; i++) {
+        if (i + XS_BATCH_PREFETCH < hi) {
+            const xs *ahead = &batch->arr[i + XS_BATCH_PREFETCH];
+            if (xs_is_ptr(ahead))
+                __builtin_prefetch(ahead->ptr);
+        }
+        batch->op(&batch->arr[i], i, batch->arg);
+    }
+}
+
+/* Strings that share a buffer through xs_cpy keep one plain count, which
+ * an op that detaches or frees them would update from several threads at
+ * once. With more than one thread, such strings get private copies in a
+ * serial pass first, so op may modify or free any of them; op must not
+ * xs_cpy one element into another.
+ */
+void xs_batch_apply(xs *arr, size_t n, void (*op)(xs *, size_t, void *),
+                    void *arg, int nthreads)
+{
+    if (nthreads > 1)
+        for (size_t i = 0; i < n; i++)
+            if (xs_is_ptr(&arr[i]) && !arr[i].flag3 && arr[i].refcnt)
+                xs_make_writable(&arr[i]);
+    struct xs_batch batch = {arr, n, op, arg};
+    xs_par_run((n + XS_BATCH_BLOCK - 1) / XS_BATCH_BLOCK, nthreads,
+               xs_batch_block, &batch);
+}
+
+/* ready-made ops for xs_batch_apply */
+void xs_batch_op_trim(xs *x, size_t i, void *trimset)
+{
+    (void) i;
+    xs_trim(x, trimset);
+}
+
+void xs_batch_op_tolower(xs *x, size_t i, void *arg)
+{
+    (void) i;
+    (void) arg;
+    xs_tolower(x);
+}
+
+static inline uint64_t xs_hash_mix(uint64_t h, uint64_t w)
+{
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    return h ^ h >> 29;
+}
+
+/* 64-bit hash of the contents, 8 bytes per step */
+uint64_t xs_hash(const xs *x)
+{
+    const char *p = xs_data(x);
+    size_t len = xs_size(x), i = 0;
+    uint64_t h = len * 0xff51afd7ed558ccdULL, w;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, p + i, 8);
+        h = xs_hash_mix(h, w);
+    }
+    if (i < len) {
+        w = 0;
+        memcpy(&w, p + i, len - i);
+        h = xs_hash_mix(h, w);
+    }
+    return xs_hash_mix(h, h >> 32);
+}
+
+static inline bool xs_equal(const xs *a, const xs *b)
+{
+    size_t len = xs_size(a);
+    return len == xs_size(b) && !memcmp(xs_data(a), xs_data(b), len);
+}
+
+/* Batch versions touch the heap buffer of the string XS_GROUP positions
+ * ahead before working on the current one, so the loads of a whole group
+ * are in flight at once instead of stalling one by one on ptr.
+ */
+#define XS_GROUP 8
+
+static inline void xs_prefetch_data(const xs *x)
+{
+    if (xs_is_ptr(x))
+        __builtin_prefetch(x->ptr);
+}
+
+void xs_hash_batch(const xs *keys, size_t n, uint64_t *out)
+{
+    for (size_t i = 0; i < n && i < XS_GROUP; i++)
+        xs_prefetch_data(&keys[i]);
+    for (size_t i = 0; i < n; i++) {
+        if (i + XS_GROUP < n)
+            xs_prefetch_data(&keys[i + XS_GROUP]);
+        out[i] = xs_hash(&keys[i]);
+    }
+}
+
+void xs_equal_batch(const xs *a, const xs *b, size_t n, bool *out)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (i + XS_GROUP < n) {
+            xs_prefetch_data(&a[i + XS_GROUP]);
+            xs_prefetch_data(&b[i + XS_GROUP]);
+        }
+        out[i] = xs_equal(&a[i], &b[i]);
+    }
+}
+
+/* Index of the first candidate equal to probe, n if there is none. An
+ * inline string is entirely described by its first 16 bytes, so for an
+ * inline probe each candidate costs one 16-byte load and compare: the
+ * probe's data bytes plus its size and is_ptr bits in the last byte,
+ * everything past the data masked off. Only heap candidates (or a heap
+ * probe) fall back to comparing sizes and data.
+ */
+size_t xs_find_equal(const xs *probe, const xs *cands, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    if (!xs_is_ptr(probe)) {
+        uint8_t m[16] = {0};
+        memset(m, 0xff, xs_size(probe));
+        m[15] = 0x1f; /* space_left and is_ptr, not flag1..3 */
+        const __m128i mask = _mm_loadu_si128((const __m128i *) m);
+        const __m128i want =
+            _mm_and_si128(_mm_loadu_si128((const __m128i *) probe), mask);
+        for (; i < n; i++) {
+            __m128i c = _mm_loadu_si128((const __m128i *) &cands[i]);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(c, mask),
+                                                 want)) == 0xffff)
+                return i;
+            if (xs_is_ptr(&cands[i]) && xs_equal(probe, &cands[i]))
+                return i;
+        }
+        return n;
+    }
+#endif
+    for (; i < n; i++)
+        if (xs_equal(probe, &cands[i]))
+            return i;
+    return n;
+}
+
+/* Open-addressing hash map from xs keys to their insertion index. Each slot
+ * keeps the upper half of the key's hash, so probing a slot only follows
+ * the key's heap pointer when the tags already match.
+ */
+struct xs_map_slot {
+    uint32_t idx; /* key index + 1, 0 when empty */
+    uint32_t tag;
+};
+
+typedef struct {
+    xs *keys;
+    size_t nkeys, capkeys;
+    struct xs_map_slot *slots;
+    size_t mask;
+} xs_map;
+
+#define XS_MAP_NOTFOUND ((size_t) -1)
+
+void xs_map_init(xs_map *m)
+{
+    m->keys = NULL;
+    m->nkeys = m->capkeys = 0;
+    m->mask = 15;
+    m->slots = calloc(m->mask + 1, sizeof(*m->slots));
+}
+
+void xs_map_free(xs_map *m)
+{
+    for (size_t i = 0; i < m->nkeys; i++)
+        xs_free(&m->keys[i]);
+    free(m->keys);
+    free(m->slots);
+}
+
+static size_t xs_map_probe(const xs_map *m, const xs *key, uint64_t h)
+{
+    uint32_t tag = h >> 32;
+    for (size_t s = h & m->mask;; s = (s + 1) & m->mask) {
+        const struct xs_map_slot *slot = &m->slots[s];
+        if (!slot->idx)
+            return XS_MAP_NOTFOUND;
+        if (slot->tag == tag && xs_equal(&m->keys[slot->idx - 1], key))
+            return slot->idx - 1;
+    }
+}
+
+static inline size_t xs_map_find(const xs_map *m, const xs *key)
+{
+    return xs_map_probe(m, key, xs_hash(key));
+}
+
+static void xs_map_place(xs_map *m, uint64_t h, size_t idx)
+{
+    size_t s = h & m->mask;
+    while (m->slots[s].idx)
+        s = (s + 1) & m->mask;
+    m->slots[s] = (struct xs_map_slot){idx + 1, h >> 32};
+}
+
+/* index of key, moving key into the map when it is not there yet; a key
+ * that is already present is left with the caller
+ */
+size_t xs_map_insert(xs_map *m, xs *key)
+{
+    uint64_t h = xs_hash(key);
+    size_t idx = xs_map_probe(m, key, h);
+    if (idx != XS_MAP_NOTFOUND)
+        return idx;
+
+    if (m->nkeys == m->capkeys) {
+        m->capkeys = m->capkeys ? m->capkeys * 2 : 16;
+        m->keys = realloc(m->keys, m->capkeys * sizeof(*m->keys));
+    }
+    if ((m->nkeys + 1) * 4 > (m->mask + 1) * 3) {
+        free(m->slots);
+        m->mask = m->mask * 2 + 1;
+        m->slots = calloc(m->mask + 1, sizeof(*m->slots));
+        for (size_t i = 0; i < m->nkeys; i++)
+            xs_map_place(m, xs_hash(&m->keys[i]), i);
+    }
+    idx = m->nkeys++;
+    xs_move(&m->keys[idx], key);
+    xs_map_place(m, h, idx);
+    return idx;
+}
+
+/* Look up n keys, storing each index or XS_MAP_NOTFOUND in out. Keys go
+ * through in groups: hash the whole group while prefetching the next
+ * group's key data and this group's home slots, then probe them all, so
+ * the cache misses of a group overlap.
+ */
+void xs_map_find_batch(const xs_map *m, const xs *keys, size_t n, size_t *out)
+{
+    uint64_t h[XS_GROUP];
+    for (size_t i = 0; i < n && i < XS_GROUP; i++)
+        xs_prefetch_data(&keys[i]);
+    for (size_t g = 0; g < n; g += XS_GROUP) {
+        size_t cnt = n - g < XS_GROUP ? n - g : XS_GROUP;
+        for (size_t j = 0; j < cnt; j++) {
+            if (g + XS_GROUP + j < n)
+                xs_prefetch_data(&keys[g + XS_GROUP + j]);
+            h[j] = xs_hash(&keys[g + j]);
+            __builtin_prefetch(&m->slots[h[j] & m->mask]);
+        }
+        for (size_t j = 0; j < cnt; j++)
+            out[g + j] = xs_map_probe(m, &keys[g + j], h[j]);
+    }
+}
+
+/* Trigram prefilter for substring search over many documents. Every
+ * trigram of a document is hashed to one of XS_NGRAM_BUCKETS posting lists
+ * that record the document ids containing it, in insertion order. A query
+ * intersects the lists of its own trigrams, shortest first, and runs the
+ * real search only on the documents left. Hash collisions only let extra
+ * candidates through, never drop a match. Documents are referenced, not
+ * copied: each must stay alive and unchanged while it is indexed.
+ */
+#define XS_NGRAM_BUCKETS (1 << 16)
+
+struct xs_posting {
+    uint32_t *ids;
+    uint32_t n, cap;
+};
+
+typedef struct {
+    const xs **docs;
+    size_t ndocs, capdocs;
+    struct xs_posting *lists;
+} xs_ngram_index;
+
+static inline uint32_t xs_trigram(const char *p)
+{
+    uint32_t t = (uint8_t) p[0] | (uint8_t) p[1] << 8 | (uint8_t) p[2] << 16;
+    return (t * 2654435761u) >> (32 - 16);
+}
+
+void xs_ngram_init(xs_ngram_index *idx)
+{
+    idx->docs = NULL;
+    idx->ndocs = idx->capdocs = 0;
+    idx->lists = calloc(XS_NGRAM_BUCKETS, sizeof(*idx->lists));
+}
+
+void xs_ngram_free(xs_ngram_index *idx)
+{
+    for (size_t b = 0; b < XS_NGRAM_BUCKETS; b++)
+        free(idx->lists[b].ids);
+    free(idx->lists);
+    free(idx->docs);
+}
+
+/* index one more document, returns its id */
+size_t xs_ngram_add(xs_ngram_index *idx, const xs *doc)
+{
+    if (idx->ndocs == idx->capdocs) {
+        idx->capdocs = idx->capdocs ? idx->capdocs * 2 : 16;
+        idx->docs = realloc(idx->docs, idx->capdocs * sizeof(*idx->docs));
+    }
+    uint32_t id = idx->ndocs++;
+    idx->docs[id] = doc;
+
+    const char *p = xs_data(doc);
+    size_t len = xs_size(doc);
+    for (size_t i = 0; i + 3 <= len; i++) {
+        struct xs_posting *l = &idx->lists[xs_trigram(p + i)];
+        if (l->n && l->ids[l->n - 1] == id)
+            continue;
+        if (l->n == l->cap) {
+            l->cap = l->cap ? l->cap * 2 : 4;
+            l->ids = realloc(l->ids, l->cap * sizeof(*l->ids));
+        }
+        l->ids[l->n++] = id;
+    }
+    return id;
+}
+
+/* Ids of the documents containing needle, ascending, up to max of them in
+ * out; returns the total number of matches.
+ */
+size_t xs_ngram_search(const xs_ngram_index *idx, const xs *needle,
+                       size_t *out, size_t max)
+{
+    const char *n = xs_data(needle);
+    size_t nlen = xs_size(needle), found = 0;
+
+    /* shortest posting list among the needle's trigrams drives the scan */
+    const struct xs_posting *lists[64];
+    size_t nlists = 0;
+    for (size_t i = 0; i + 3 <= nlen && nlists < 64; i++) {
+        const struct xs_posting *l = &idx->lists[xs_trigram(n + i)];
+        if (!l->n)
+            return 0;
+        lists[nlists++] = l;
+    }
+    for (size_t i = 1; i < nlists; i++)
+        if (lists[i]->n < lists[0]->n) {
+            const struct xs_posting *t = lists[0];
+            lists[0] = lists[i];
+            lists[i] = t;
+        }
+
+    size_t ncand = nlists ? lists[0]->n : idx->ndocs;
+    size_t *pos = calloc(nlists ? nlists : 1, sizeof(*pos));
+    for (size_t c = 0; c < ncand; c++) {
+        uint32_t id = nlists ? lists[0]->ids[c] : c;
+        bool all = true;
+        for (size_t k = 1; k < nlists && all; k++) {
+            const struct xs_posting *l = lists[k];
+            while (pos[k] < l->n && l->ids[pos[k]] < id)
+                pos[k]++;
+            all = pos[k] < l->n && l->ids[pos[k]] == id;
+        }
+        if (!all)
+            continue;
+        const xs *doc = idx->docs[id];
+        if (!xs_memmem(xs_data(doc), xs_size(doc), n, nlen))
+            continue;
+        if (found < max)
+            out[found] = id;
+        found++;
+    }
+    free(pos);
+    return found;
+}
+
+/* Buzhash rolling hash over fixed windows of a string. The hash of each
+ * window is updated in O(1) from the previous one by rotating it, cancelling
+ * the byte that leaves and mixing in the byte that enters.
+ */
+typedef struct {
+    const char *p;
+    size_t len, pos, window;
+    uint64_t h;
+} xs_rolling;
+
+static inline uint64_t xs_rotl64(uint64_t v, unsigned r)
+{
+    r &= 63;
+    return r ? (v << r) | (v >> (64 - r)) : v;
+}
+
+/* per-byte random value, splitmix64 finalizer instead of a 2 KiB table */
+static inline uint64_t xs_buz(uint8_t c)
+{
+    uint64_t z = (c + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void xs_rolling_init(xs_rolling *r, const xs *x, size_t window)
+{
+    r->p = xs_data(x);
+    r->len = xs_size(x);
+    r->window = window ? window : 1;
+    r->pos = 0;
+    r->h = 0;
+}
+
+/* hash of the next window and its offset; false once the string is done */
+bool xs_rolling_next(xs_rolling *r, uint64_t *hash, size_t *offset)
+{
+    size_t w = r->window;
+    if (r->pos + w > r->len)
+        return false;
+    const uint8_t *p = (const uint8_t *) r->p;
+    if (!r->pos && !r->h) {
+        for (size_t i = 0; i < w; i++)
+            r->h = xs_rotl64(r->h, 1) ^ xs_buz(p[i]);
+    } else {
+        size_t in = r->pos + w - 1;
+        r->h = xs_rotl64(r->h, 1) ^ xs_rotl64(xs_buz(p[in - w]), w) ^
+               xs_buz(p[in]);
+    }
+    *hash = r->h;
+    *offset = r->pos++;
+    return true;
+}
+
+/* Content-defined chunking: a boundary is cut where the rolling hash of the
+ * last window bytes has its low bits clear, so an edit only moves the
+ * boundaries near it. avg must be a power of two; chunks are kept within
+ * [min, max] (the final one may be shorter).
+ */
+typedef struct {
+    const char *p;
+    size_t len, pos;
+    size_t min, max, window;
+    uint64_t mask;
+} xs_cdc;
+
+void xs_cdc_init(xs_cdc *c, const xs *x, size_t min, size_t avg, size_t max)
+{
+    c->p = xs_data(x);
+    c->len = xs_size(x);
+    c->pos = 0;
+    c->window = 48;
+    c->min = min > c->window ? min : c->window;
+    c->max = max > c->min ? max : c->min;
+    c->mask = avg ? avg - 1 : 0;
+}
+
+bool xs_cdc_next(xs_cdc *c, xs_view *chunk)
+{
+    size_t start = c->pos, left = c->len - start;
+    if (!left)
+        return false;
+    size_t end = left <= c->min ? left : 0, w = c->window;
+    if (!end) {
+        const uint8_t *p = (const uint8_t *) c->p + start;
+        size_t lim = left < c->max ? left : c->max;
+        uint64_t h = 0;
+        for (size_t i = c->min - w; i < c->min; i++)
+            h = xs_rotl64(h, 1) ^ xs_buz(p[i]);
+        for (end = c->min; end < lim && (h & c->mask); end++)
+            h = xs_rotl64(h, 1) ^ xs_rotl64(xs_buz(p[end - w]), w) ^
+                xs_buz(p[end]);
+    }
+    chunk->ptr = c->p + start;
+    chunk->len = end;
+    c->pos = start + end;
+    return true;
+}
+
+/* Natural-order collation key: comparing two keys bytewise (memcmp over the
+ * shorter length, then the shorter key first) orders the source strings
+ * the way a natural comparator would, so "file9" < "file10". A digit run
+ * becomes '0', a length byte (255 then 8 big-endian bytes when longer) and
+ * its digits without leading zeros, so longer numbers sort later. Other
+ * bytes are copied, with 0x00 and 0x01 escaped to keep 0x00 free for the
+ * terminator. The leading zero counts follow the terminator to break ties
+ * between "1" and "01" without affecting the primary order.
+ */
+static size_t xs_collate_key_len(const uint8_t *p, size_t n)
+{
+    size_t len = 1; /* terminator */
+    for (size_t i = 0; i < n;) {
+        if (p[i] < '0' || p[i] > '9') {
+            len += p[i] <= 1 ? 2 : 1;
+            i++;
+            continue;
+        }
+        size_t z = i, end;
+        while (z < n && p[z] == '0')
+            z++;
+        for (end = z; end < n && p[end] >= '0' && p[end] <= '9'; end++)
+            ;
+        /* '0', length, digits and the tie-break byte after the terminator */
+        len += 1 + (end - z < 255 ? 1 : 9) + (end - z) + 1;
+        i = end;
+    }
+    return len;
+}
+
+xs *xs_collate_key_append(xs *out, xs_view in)
+{
+    const uint8_t *p = (const uint8_t *) in.ptr;
+    size_t n = in.len;
+    char *o = xs_append_reserve(out, xs_collate_key_len(p, n));
+    size_t runs = 0;
+
+    for (size_t i = 0; i < n;) {
+        if (p[i] < '0' || p[i] > '9') {
+            if (p[i] <= 1) {
+                *o++ = 1;
+                *o++ = p[i] + 1;
+            } else {
+                *o++ = p[i];
+            }
+            i++;
+            continue;
+        }
+        size_t z = i, end;
+        while (z < n && p[z] == '0')
+            z++;
+        for (end = z; end < n && p[end] >= '0' && p[end] <= '9'; end++)
+            ;
+        size_t digits = end - z;
+        *o++ = '0';
+        if (digits < 255) {
+            *o++ = digits;
+        } else {
+            *o++ = (char) 255;
+            for (int s = 56; s >= 0; s -= 8)
+                *o++ = (uint64_t) digits >> s;
+        }
+        memcpy(o, p + z, digits);
+        o += digits;
+        i = end;
+        runs++;
+    }
+    *o++ = 0;
+
+    /* tie-break: leading zero counts in order of appearance */
+    for (size_t i = 0; runs && i < n;) {
+        if (p[i] < '0' || p[i] > '9') {
+            i++;
+            continue;
+        }
+        size_t z = i;
+        while (z < n && p[z] == '0')
+            z++;
+        *o++ = z - i < 255 ? z - i : 255;
+        while (z < n && p[z] >= '0' && p[z] <= '9')
+            z++;
+        i = z;
+    }
+    return out;
+}
+
+/* first 8 key bytes as a big-endian integer, for radix sorts and
+ * prefix-key comparisons; ties still need the full keys
+ */
+uint64_t xs_collate_prefix(xs_view key)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < 8; i++)
+        v = v << 8 | (i < key.len ? (uint8_t) key.ptr[i] : 0);
+    return v;
+}
+
+/* dst[0, unit) is already written; repeat it until total bytes are filled,
+ * copying the whole written prefix each time so only log(total / unit)
+ * memcpy calls are made
+ */
+static void xs_fill_doubling(char *dst, size_t unit, size_t total)
+{
+    if (unit == 1) {
+        memset(dst + 1, dst[0], total - 1);
+        return;
+    }
+    for (size_t done = unit; done < total; done *= 2)
+        memcpy(dst + done, dst, done < total - done ? done : total - done);
+}
+
+/* x repeated n times; NULL with x unchanged if the result would not fit in
+ * the 54-bit size field
+ */
+xs *xs_repeat(xs *x, size_t n)
+{
+    size_t size = xs_size(x), total;
+    if (__builtin_mul_overflow(size, n, &total) || total >> 54)
+        return NULL;
+    if (!size || n == 1)
+        return x;
+    if (!n) {
+        xs_make_writable(x);
+        xs_truncate(x, 0);
+        return x;
+    }
+    xs_append_reserve(x, total - size);
+    xs_fill_doubling(xs_data(x), size, total);
+    return x;
+}
+
+/* replace the contents of x with n copies of c */
+xs *xs_fill(xs *x, char c, size_t n)
+{
+    xs_data(x);
+    bool epoch = xs_is_ptr(x) && x->flag2;
+    /* a buffer that is not ours alone is let go of, not copied, since none
+     * of its bytes are kept
+     */
+    if (xs_is_ptr(x) && (x->flag1 || x->flag2 || x->refcnt))
+        xs_free(x);
+    else
+        xs_truncate(x, 0);
+    memset(xs_append_reserve(x, n), c, n);
+    return xs_keep_epoch(x, epoch);
+}
+
+/* pad x with fill to width bytes: the extra goes before the content, after
+ * it, or on both sides with the odd byte on the right
+ */
+static xs *xs_pad(xs *x, size_t width, char fill, size_t left_share)
+{
+    size_t size = xs_size(x);
+    if (size >= width)
+        return x;
+    size_t pad = width - size, left = pad * left_share / 2;
+    xs_append_reserve(x, pad);
+    char *data = xs_data(x);
+    if (left) {
+        memmove(data + left, data, size);
+        memset(data, fill, left);
+    }
+    memset(data + left + size, fill, pad - left);
+    return x;
+}
+
+xs *xs_pad_left(xs *x, size_t width, char fill)
+{
+    return xs_pad(x, width, fill, 2);
+}
+
+xs *xs_pad_right(xs *x, size_t width, char fill)
+{
+    return xs_pad(x, width, fill, 0);
+}
+
+xs *xs_pad_center(xs *x, size_t width, char fill)
+{
+    return xs_pad(x, width, fill, 1);
+}
+
+/* Unicode 14.0.0 tables, regenerated by scripts/gen_unicode_tables.py
+ * from CaseFolding.txt and PropList.txt; do not edit them by hand.
+ *
+ * Simple case folding (status C and S): a code point's 256-entry block is
+ * looked up in stage1, the block maps it to an index into a table of code
+ * point deltas. Code points at or above XS_FOLD_LIMIT fold to themselves.
+ * xs_uspace_ranges holds the White_Space ranges, sorted.
+ */
+/* BEGIN generated Unicode tables, see scripts/gen_unicode_tables.py */
+#define XS_UNICODE_VERSION "14.0.0"
+#define XS_FOLD_LIMIT 0x1EA00
+static const uint8_t xs_fold_stage1[490] = {
+    0, 1, 2, 3, 4, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    7, 6, 6, 8, 6, 6, 6, 6, 6, 6, 6, 6, 9, 6, 10, 11,
+    6, 12, 6, 6, 13, 6, 6, 6, 6, 6, 6, 6, 14, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 15, 16, 6, 6, 6, 17, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 18,
+    6, 6, 6, 6, 19, 20, 6, 6, 6, 6, 6, 6, 21, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 22, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 23, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 24,
+};
+static const uint8_t xs_fold_stage2[25][256] = {
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 93, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        66, 66, 66, 66, 66, 66, 66, 0, 66, 66, 66, 66, 66, 66, 66, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        0, 0, 59, 0, 59, 0, 59, 0, 0, 59, 0, 59, 0, 59, 0, 59,
+        0, 59, 0, 59, 0, 59, 0, 59, 0, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 40, 59, 0, 59, 0, 59, 0, 34,
+        0, 86, 59, 0, 59, 0, 83, 59, 0, 82, 82, 59, 0, 0, 77, 80,
+        81, 59, 0, 82, 84, 0, 87, 85, 59, 0, 0, 0, 87, 88, 0, 89,
+        59, 0, 59, 0, 59, 0, 91, 59, 0, 91, 0, 0, 59, 0, 91, 59,
+        0, 90, 90, 59, 0, 59, 0, 92, 59, 0, 0, 0, 59, 0, 0, 0,
+        0, 0, 0, 0, 60, 59, 0, 60, 59, 0, 60, 59, 0, 59, 0, 59,
+        0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        0, 60, 59, 0, 59, 0, 43, 49, 59, 0, 59, 0, 59, 0, 59, 0,
+    },
+    {
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        37, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 0, 0, 0, 0, 0, 0, 97, 59, 0, 36, 96, 0,
+        0, 59, 0, 35, 75, 76, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 79, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        59, 0, 59, 0, 0, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0, 79,
+        0, 0, 0, 0, 0, 0, 69, 0, 68, 68, 68, 0, 74, 0, 73, 73,
+        0, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        66, 66, 0, 66, 66, 66, 66, 66, 66, 66, 66, 66, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 61,
+        52, 53, 0, 0, 0, 55, 54, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        50, 51, 0, 0, 47, 46, 0, 59, 0, 58, 59, 0, 0, 37, 37, 37,
+    },
+    {
+        78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 0, 0, 0, 0, 0, 0, 0, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        62, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+    },
+    {
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        0, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72,
+        72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72,
+        72, 72, 72, 72, 72, 72, 72, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95,
+        95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95, 95,
+        95, 95, 95, 95, 95, 95, 0, 95, 0, 0, 0, 0, 0, 95, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        25, 26, 27, 29, 29, 28, 30, 31, 98, 0, 0, 0, 0, 0, 0, 0,
+        33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33,
+        33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33,
+        33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 33, 0, 0, 33, 33, 33,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 0, 0, 0, 0, 0, 48, 0, 0, 22, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 57, 57,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 57, 57,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 57, 57,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 57, 0, 57, 0, 57, 0, 57,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 57, 57,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 57, 57,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 57, 57,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 57, 57, 57, 57, 57, 57,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 45, 45, 56, 0, 24, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 44, 44, 44, 44, 56, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 42, 42, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 57, 57, 41, 41, 58, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 38, 38, 39, 39, 56, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 23, 0, 0, 0, 20, 21, 0, 0, 0, 0,
+        0, 0, 65, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72,
+        72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72,
+        72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72, 72,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        59, 0, 18, 32, 19, 0, 0, 59, 0, 59, 0, 59, 0, 16, 17, 14,
+        15, 0, 59, 0, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0, 13, 13,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0, 59, 0, 59, 0, 0,
+        0, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        0, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 59, 0, 59, 0, 12, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 0, 0, 0, 59, 0, 7, 0, 0,
+        59, 0, 59, 0, 0, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 3, 1, 2, 5, 3, 0,
+        9, 6, 8, 94, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0, 59, 0,
+        59, 0, 59, 0, 51, 4, 11, 59, 0, 59, 0, 0, 0, 0, 0, 0,
+        59, 0, 0, 0, 0, 0, 59, 0, 59, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+        10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+        10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+        10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+        10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71,
+        71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71,
+        71, 71, 71, 71, 71, 71, 71, 71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71,
+        71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71, 71,
+        71, 71, 71, 71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        70, 70, 70, 70, 70, 70, 70, 70, 70, 70, 70, 0, 70, 70, 70, 70,
+        70, 70, 70, 70, 70, 70, 70, 70, 70, 70, 70, 0, 70, 70, 70, 70,
+        70, 70, 70, 0, 70, 70, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74,
+        74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74,
+        74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74, 74,
+        74, 74, 74, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {
+        67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67,
+        67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67, 67,
+        67, 67, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    },
+};
+static const int32_t xs_fold_delta[99] = {
+    0, -42319, -42315, -42308, -42307, -42305, -42282, -42280,
+    -42261, -42258, -38864, -35384, -35332, -10815, -10783, -10782,
+    -10780, -10749, -10743, -10727, -8383, -8262, -7615, -7517,
+    -7173, -6222, -6221, -6212, -6211, -6210, -6204, -6180,
+    -3814, -3008, -268, -195, -163, -130, -128, -126,
+    -121, -112, -100, -97, -86, -74, -64, -60,
+    -58, -56, -54, -48, -30, -25, -22, -15,
+    -9, -8, -7, 1, 2, 8, 15, 16,
+    26, 28, 32, 34, 37, 38, 39, 40,
+    48, 63, 64, 69, 71, 79, 80, 116,
+    202, 203, 205, 206, 207, 209, 210, 211,
+    213, 214, 217, 218, 219, 775, 928, 7264,
+    10792, 10795, 35267,
+};
+static const uint32_t xs_uspace_ranges[10][2] = {
+    {0x0009, 0x000D},
+    {0x0020, 0x0020},
+    {0x0085, 0x0085},
+    {0x00A0, 0x00A0},
+    {0x1680, 0x1680},
+    {0x2000, 0x200A},
+    {0x2028, 0x2029},
+    {0x202F, 0x202F},
+    {0x205F, 0x205F},
+    {0x3000, 0x3000},
+};
+/* END generated Unicode tables */
+
+static inline uint32_t xs_fold_cp(uint32_t cp)
+{
+    if (cp >= XS_FOLD_LIMIT)
+        return cp;
+    return cp + xs_fold_delta[xs_fold_stage2[xs_fold_stage1[cp >> 8]][cp & 255]];
+}
+
+/* length of the leading run of bytes below 0x80 */
+static size_t xs_ascii_prefix(const char *p, size_t len)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= len; i += 32) {
+        uint32_t m = _mm256_movemask_epi8(
+            _mm256_loadu_si256((const __m256i *) (p + i)));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+#endif
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        uint32_t m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (p + i)));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+#endif
+    while (i < len && !((uint8_t) p[i] & 0x80))
+        i++;
+    return i;
+}
+
+static char *xs_utf8_encode(char *o, uint32_t cp)
+{
+    if (cp < 0x80) {
+        *o++ = cp;
+    } else if (cp < 0x800) {
+        *o++ = 0xc0 | cp >> 6;
+        *o++ = 0x80 | (cp & 0x3f);
+    } else if (cp < 0x10000) {
+        *o++ = 0xe0 | cp >> 12;
+        *o++ = 0x80 | (cp >> 6 & 0x3f);
+        *o++ = 0x80 | (cp & 0x3f);
+    } else {
+        *o++ = 0xf0 | cp >> 18;
+        *o++ = 0x80 | (cp >> 12 & 0x3f);
+        *o++ = 0x80 | (cp >> 6 & 0x3f);
+        *o++ = 0x80 | (cp & 0x3f);
+    }
+    return o;
+}
+
+/* Case fold UTF-8 text in place. Pure ASCII strings, found with a vector
+ * scan for high bytes, only need xs_tolower; otherwise the string is
+ * rebuilt since a folded character can change its encoded length.
+ * Malformed bytes are kept as they are.
+ */
+xs *xs_casefold(xs *x)
+{
+    const char *p = xs_data(x);
+    size_t len = xs_size(x), i = xs_ascii_prefix(p, len);
+    if (i == len)
+        return xs_tolower(x);
+
+    /* folding grows a sequence by at most one byte in two */
+    xs tmp = xs_literal_empty();
+    char *o = xs_append_reserve(&tmp, len + len / 2), *base = o;
+    for (size_t k = 0; k < i; k++)
+        *o++ = p[k] >= 'A' && p[k] <= 'Z' ? p[k] + 'a' - 'A' : p[k];
+    while (i < len) {
+        uint32_t cp;
+        size_t n = xs_utf8_decode((const uint8_t *) p + i, len - i, &cp);
+        if (!n) {
+            *o++ = p[i++];
+            continue;
+        }
+        o = xs_utf8_encode(o, xs_fold_cp(cp));
+        i += n;
+    }
+    xs_truncate(&tmp, o - base);
+
+    bool epoch = xs_is_ptr(x) && x->flag2;
+    xs_free(x);
+    *x = tmp;
+    return xs_keep_epoch(x, epoch);
+}
+
+/* White_Space code points of the Unicode character database */
+static inline bool xs_is_uspace(uint32_t cp)
+{
+    if (cp < 0x80)
+        return cp == ' ' || (cp >= '\t' && cp <= '\r');
+    const size_t n = sizeof(xs_uspace_ranges) / sizeof(*xs_uspace_ranges);
+    for (size_t i = 0; i < n && cp >= xs_uspace_ranges[i][0]; i++) {
+        if (cp <= xs_uspace_ranges[i][1])
+            return true;
+    }
+    return false;
+}
+
+/* like xs_trim but removes Unicode whitespace from both ends */
+xs *xs_trim_unicode(xs *x)
+{
+    const uint8_t *p = (const uint8_t *) xs_data(x);
+    size_t len = xs_size(x), start = 0, end = len;
+    uint32_t cp;
+
+    while (start < end) {
+        size_t n = xs_utf8_decode(p + start, end - start, &cp);
+        if (!n || !xs_is_uspace(cp))
+            break;
+        start += n;
+    }
+    while (end > start) {
+        size_t s = end - 1;
+        while (s > start && end - s < 4 && (p[s] & 0xc0) == 0x80)
+            s--;
+        if (xs_utf8_decode(p + s, end - s, &cp) != end - s ||
+            !xs_is_uspace(cp))
+            break;
+        end = s;
+    }
+    if (start == 0 && end == len)
+        return x;
+
+    char *data = xs_make_writable(x);
+    memmove(data, data + start, end - start);
+    xs_truncate(x, end - start);
+    return x;
+}
+
+#ifdef XS_BENCH
+#include <time.h>
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* one million records, every fourth one too long to stay inline */
+static void bench_new_batch(void)
+{
+    enum { N = 1 << 20 };
+    const char **src = malloc(N * sizeof(*src));
+    xs *arr = malloc(N * sizeof(*arr));
+    static const char *words[] = {"id", "user_name",
+                                  "a rather long field value 0123456789",
+                                  "host.example"};
+    for (size_t i = 0; i < N; i++)
+        src[i] = words[i % 4];
+
+    double t = bench_now();
+    for (size_t i = 0; i < N; i++)
+        xs_new(&arr[i], src[i]);
+    for (size_t i = 0; i < N; i++)
+        xs_free(&arr[i]);
+    printf("xs_new x %d:       %.3f ms\n", N, (bench_now() - t) * 1e3);
+
+    t = bench_now();
+    char *arena = xs_new_batch(arr, src, N);
+    xs_free_batch(arr, N, arena);
+    printf("xs_new_batch x %d: %.3f ms\n", N, (bench_now() - t) * 1e3);
+
+    free(arr);
+    free(src);
+}
+
+/* one million lookups of 2^18 distinct keys, with short keys that stay
+ * inline and with long keys that live on the heap
+ */
+static void bench_map_find_batch(void)
+{
+    enum { K = 1 << 18, N = 1 << 20 };
+    xs *queries = malloc(N * sizeof(*queries));
+    size_t *out = malloc(N * sizeof(*out)), sink = 0;
+    char buf[64];
+
+    for (int heavy = 0; heavy < 2; heavy++) {
+        xs_map m;
+        xs_map_init(&m);
+        for (size_t i = 0; i < K; i++) {
+            xs key;
+            snprintf(buf, sizeof(buf), heavy ? "heap-allocated-key-%zu" : "k%zu", i);
+            xs_map_insert(&m, xs_new(&key, buf));
+        }
+        srand(1);
+        for (size_t i = 0; i < N; i++) {
+            snprintf(buf, sizeof(buf), heavy ? "heap-allocated-key-%d" : "k%d",
+                     rand() % (K + K / 8));
+            xs_new(&queries[i], buf);
+        }
+
+        double t = bench_now();
+        for (size_t i = 0; i < N; i++)
+            sink += xs_map_find(&m, &queries[i]);
+        printf("%s keys, xs_map_find x %d:       %.3f ms\n",
+               heavy ? "heap" : "inline", N, (bench_now() - t) * 1e3);
+        t = bench_now();
+        xs_map_find_batch(&m, queries, N, out);
+        printf("%s keys, xs_map_find_batch x %d: %.3f ms\n",
+               heavy ? "heap" : "inline", N, (bench_now() - t) * 1e3);
+        sink += out[N - 1];
+
+        for (size_t i = 0; i < N; i++)
+            xs_free(&queries[i]);
+        xs_map_free(&m);
+    }
+    free(out);
+    free(queries);
+    if (sink == 42)
+        printf("\n");
+}
+#endif
+
+/* Multi-threaded smoke check of the lock-free append buffer, the epoch
+ * reader/writer protocol and the deferred free thread, run by the demo.
+ */
+#define SMOKE_THREADS 4
+#define SMOKE_ROUNDS 20000
+
+static xs_mpsc_buffer smoke_mpsc;
+static xs *smoke_shared;
+
+static void *smoke_producer(void *arg)
+{
+    char rec[8];
+    memset(rec, 'a' + (int) (intptr_t) arg, sizeof(rec));
+    for (int i = 0; i < SMOKE_ROUNDS; i++)
+        xs_mpsc_append(&smoke_mpsc, rec, sizeof(rec));
+    return NULL;
+}
+
+static bool smoke_mpsc_check(void)
+{
+    pthread_t t[SMOKE_THREADS];
+    size_t counts[SMOKE_THREADS] = {0}, total = 0;
+    bool ok = true;
+    xs out;
+
+    xs_mpsc_init(&smoke_mpsc, 4096);
+    for (intptr_t i = 0; i < SMOKE_THREADS; i++)
+        pthread_create(&t[i], NULL, smoke_producer, (void *) i);
+    for (int done = 0; done < SMOKE_THREADS;) {
+        /* consume while the producers are still appending */
+        if (xs_mpsc_pop(&smoke_mpsc, &out, false)) {
+            const char *p = xs_data(&out);
+            for (size_t i = 0; i < xs_size(&out); i++)
+                counts[(p[i] - 'a') & (SMOKE_THREADS - 1)]++;
+            total += xs_size(&out);
+            xs_free(&out);
+        } else if (pthread_join(t[done], NULL) == 0) {
+            done++;
+        }
+    }
+    while (xs_mpsc_pop(&smoke_mpsc, &out, true)) {
+        const char *p = xs_data(&out);
+        for (size_t i = 0; i < xs_size(&out); i++)
+            counts[(p[i] - 'a') & (SMOKE_THREADS - 1)]++;
+        total += xs_size(&out);
+        xs_free(&out);
+    }
+    xs_mpsc_destroy(&smoke_mpsc);
+    for (int i = 0; i < SMOKE_THREADS; i++)
+        ok &= counts[i] == SMOKE_ROUNDS * 8;
+
+    /* overlapping producers keep inflight above 0 at every pop, yet retired
+     * segment headers must still be reclaimed
+     */
+    xs_mpsc_init(&smoke_mpsc, 16);
+    size_t *prev = NULL;
+    for (int i = 0; i < 64; i++) {
+        size_t *held = &smoke_mpsc.inflight[smoke_mpsc.gen & 1];
+        (*held)++;
+        xs_mpsc_append(&smoke_mpsc, "0123456789abcdef", 16);
+        ok &= xs_mpsc_pop(&smoke_mpsc, &out, true);
+        xs_free(&out);
+        if (prev)
+            (*prev)--;
+        prev = held;
+        size_t kept = 0;
+        for (struct xs_mpsc_segment *r = smoke_mpsc.retired; r; r = r->retired)
+            kept++;
+        for (struct xs_mpsc_segment *r = smoke_mpsc.retiring; r; r = r->retired)
+            kept++;
+        ok &= kept <= 4;
+    }
+    (*prev)--;
+    xs_mpsc_destroy(&smoke_mpsc);
+    return ok && total == SMOKE_THREADS * SMOKE_ROUNDS * 8;
+}
+
+/* readers check that the published string is never torn or freed */
+static void *smoke_reader(void *arg)
+{
+    bool *ok = arg;
+    xs_epoch_reader *r = xs_epoch_register();
+    for (int i = 0; i < SMOKE_ROUNDS; i++) {
+        xs_epoch_enter(r);
+        xs *cur = __atomic_load_n(&smoke_shared, __ATOMIC_ACQUIRE);
+        const char *p = xs_data(cur);
+        for (size_t k = 1; k < xs_size(cur); k++)
+            if (p[k] != p[0])
+                *ok = false;
+        xs_epoch_exit(r);
+    }
+    xs_epoch_unregister(r);
+    return NULL;
+}
+
+/* writers publish fresh containers and retire the old one with its buffer */
+static void *smoke_writer(void *arg)
+{
+    for (int i = 0; i < SMOKE_ROUNDS / 10; i++) {
+        char fill[64];
+        memset(fill, 'a' + (i + (int) (intptr_t) arg) % 26, sizeof(fill));
+        xs *next = malloc(sizeof(xs));
+        xs_epoch_protect(xs_new_len(next, fill, sizeof(fill)));
+        xs *old = __atomic_exchange_n(&smoke_shared, next, __ATOMIC_ACQ_REL);
+        xs tmp = *old;
+        xs_free(&tmp);
+        xs_epoch_retire((char *) old);
+        xs_epoch_reclaim();
+    }
+    return NULL;
+}
+
+static bool smoke_epoch_check(void)
+{
+    pthread_t t[SMOKE_THREADS];
+    bool ok = true;
+
+    smoke_shared = malloc(sizeof(xs));
+    xs_epoch_protect(xs_new(smoke_shared, "a string long enough for the heap"));
+    for (intptr_t i = 0; i < SMOKE_THREADS; i++)
+        pthread_create(&t[i], NULL, i < 2 ? smoke_writer : smoke_reader,
+                       i < 2 ? (void *) i : (void *) &ok);
+    for (int i = 0; i < SMOKE_THREADS; i++)
+        pthread_join(t[i], NULL);
+    xs_epoch_reclaim();
+    xs_free(smoke_shared);
+    free(smoke_shared);
+    xs_epoch_reclaim();
+    return ok && !xs_epochs.nretired;
+}
+
+static void *smoke_freer(void *arg)
+{
+    char big[4096];
+    memset(big, 'x', sizeof(big));
+    for (int i = 0; i < SMOKE_ROUNDS / 100; i++) {
+        xs x;
+        xs_new_len(&x, big, sizeof(big));
+        xs_free(&x);
+    }
+    return arg;
+}
+
+static bool smoke_defer_check(void)
+{
+    pthread_t t[SMOKE_THREADS];
+    if (!xs_defer_free_enable(1024, (size_t) 1 << 20, true))
+        return false;
+    for (int i = 0; i < SMOKE_THREADS; i++)
+        pthread_create(&t[i], NULL, smoke_freer, NULL);
+    for (int i = 0; i < SMOKE_THREADS; i++)
+        pthread_join(t[i], NULL);
+    xs_defer_free_disable();
+    return !xs_reclaim.pending && !xs_reclaim.head;
+}
+
+/* Single-threaded behaviour checks run by the demo: round trips, empty
+ * input, the inline/heap boundary, shared input and the documented error
+ * returns. Every failure is printed with its line.
+ */
+static int check_failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("FAILED line %d: %s\n", line, what);
+        check_failures++;
+    }
+}
+
+static bool view_is(xs_view v, const char *s)
+{
+    return v.len == strlen(s) && !memcmp(v.ptr, s, v.len);
+}
+
+static bool xs_is(const xs *x, const char *s)
+{
+    return view_is(xs_view_of(x), s);
+}
+
+static void check_gap(void)
+{
+    xs x, copy;
+    xs_view before, after;
+
+    /* reads in between edits keep the cursor */
+    xs_new(&x, "hello world");
+    CHECK(xs_gap_move(&x, 5) && xs_gap_insert(&x, ",", 1));
+    xs_gap_view(&x, &before, &after);
+    CHECK(view_is(before, "hello,") && view_is(after, " world"));
+    CHECK(xs_gap_cursor(&x) == 6 && x.flag3);
+    CHECK(xs_gap_insert(&x, " dear", 5) && xs_gap_delete(&x, 1));
+    xs_gap_view(&x, &before, &after);
+    CHECK(view_is(before, "hello, dear") && view_is(after, "world"));
+    CHECK(xs_gap_backspace(&x, 100) && xs_gap_cursor(&x) == 0);
+    CHECK(xs_gap_insert(&x, "<", 1) && xs_gap_move(&x, 100) &&
+          xs_gap_insert(&x, ">", 1));
+    xs_gap_view(&x, &before, &after);
+    CHECK(view_is(before, "<world>") && after.len == 0);
+
+    /* xs_data ends gap mode and leaves the cursor at the end */
+    CHECK(xs_gap_move(&x, 1) && xs_is(&x, "<world>"));
+    CHECK(!x.flag3 && xs_gap_cursor(&x) == 7);
+    CHECK(xs_gap_insert(&x, "!", 1) && xs_is(&x, "<world>!"));
+    xs_free(&x);
+
+    /* empty input, deleting past either end */
+    xs_newempty(&x);
+    CHECK(xs_gap_delete(&x, 3) && xs_gap_backspace(&x, 3) && xs_is(&x, ""));
+    CHECK(xs_gap_insert(&x, "", 0) && xs_gap_insert(&x, "a", 1));
+    CHECK(xs_is(&x, "a"));
+    xs_free(&x);
+
+    /* crossing the inline/heap boundary */
+    xs_new(&x, "0123456789abcde");
+    CHECK(!xs_is_ptr(&x) && xs_gap_move(&x, 0) && xs_gap_insert(&x, "-", 1));
+    CHECK(xs_is_ptr(&x) && xs_is(&x, "-0123456789abcde"));
+    xs_free(&x);
+
+    /* a copy sharing the buffer is not edited through the other one */
+    xs_new(&x, "a string long enough for the heap");
+    xs_cpy(&copy, &x);
+    CHECK(xs_gap_move(&copy, 1) && xs_gap_insert(&copy, "n", 1));
+    CHECK(xs_is(&x, "a string long enough for the heap"));
+    CHECK(xs_is(&copy, "an string long enough for the heap"));
+    xs_free(&copy);
+    xs_free(&x);
+
+    /* epoch-protected strings are refused */
+    xs_epoch_protect(xs_new(&x, "a string long enough for the heap"));
+    CHECK(!xs_gap_insert(&x, "x", 1) && !xs_gap_move(&x, 0));
+    xs_free(&x);
+    xs_epoch_reclaim();
+}
+
+static bool piece_is(const xs_piece_table *pt, const char *s)
+{
+    xs flat;
+    xs_piece_flatten(pt, &flat);
+    bool ok = xs_is(&flat, s);
+    xs_free(&flat);
+    return ok;
+}
+
+static void check_piece(void)
+{
+    xs_piece_table pt;
+    xs x, copy;
+
+    /* empty document, positions past the end are clamped */
+    xs_piece_init(&pt, xs_newempty(&x));
+    CHECK(xs_piece_size(&pt) == 0 && piece_is(&pt, ""));
+    xs_piece_insert(&pt, 10, "abc", 3);
+    xs_piece_erase(&pt, 3, 1);
+    xs_piece_insert(&pt, 1, "", 0);
+    CHECK(piece_is(&pt, "abc"));
+    xs_piece_free(&pt);
+
+    /* edits and snapshots; flattening crosses the inline/heap boundary */
+    xs_piece_init(&pt, xs_new(&x, "0123456789"));
+    CHECK(xs_size(&x) == 0);
+    xs_piece_snapshot v0 = xs_piece_snapshot_take(&pt);
+    xs_piece_insert(&pt, 5, "abcdef", 6);
+    CHECK(piece_is(&pt, "01234abcdef56789"));
+    xs_piece_snapshot v1 = xs_piece_snapshot_take(&pt);
+    xs_piece_erase(&pt, 3, 10);
+    CHECK(piece_is(&pt, "012789"));
+    xs_piece_erase(&pt, 0, 100);
+    CHECK(piece_is(&pt, ""));
+    xs_piece_restore(&pt, v1);
+    CHECK(piece_is(&pt, "01234abcdef56789"));
+    xs_piece_restore(&pt, v0);
+    CHECK(piece_is(&pt, "0123456789"));
+    xs_piece_restore(&pt, v1);
+    CHECK(piece_is(&pt, "01234abcdef56789"));
+    xs_piece_snapshot_release(v0);
+    xs_piece_snapshot_release(v1);
+    xs_piece_free(&pt);
+
+    /* the table copies text that xs_cpy copies still share */
+    xs_new(&x, "a string long enough for the heap");
+    xs_cpy(&copy, &x);
+    xs_piece_init(&pt, &copy);
+    xs_piece_insert(&pt, 0, ">", 1);
+    CHECK(piece_is(&pt, ">a string long enough for the heap"));
+    CHECK(xs_is(&x, "a string long enough for the heap"));
+    xs_free(&x);
+    CHECK(piece_is(&pt, ">a string long enough for the heap"));
+    xs_piece_free(&pt);
+}
+
+static void check_replace_all(void)
+{
+    xs x, copy, n, r;
+
+    /* empty input, empty needle and no match leave x alone */
+    xs_replace_all(xs_newempty(&x), xs_new(&n, "a"), xs_new(&r, "b"));
+    CHECK(xs_is(&x, ""));
+    xs_new(&x, "banana");
+    xs_replace_all(&x, xs_newempty(&n), &r);
+    xs_replace_all(&x, xs_new(&n, "x"), &r);
+    CHECK(xs_is(&x, "banana"));
+
+    /* same length in place, growing past 15 bytes, shrinking back inline */
+    xs_replace_all(&x, xs_new(&n, "an"), xs_new(&r, "AN"));
+    CHECK(xs_is(&x, "bANANa"));
+    xs_replace_all(&x, xs_new(&n, "A"), xs_new(&r, "<long>"));
+    CHECK(xs_is_ptr(&x) && xs_is(&x, "b<long>N<long>Na"));
+    xs_replace_all(&x, xs_new(&n, "<long>"), xs_newempty(&r));
+    CHECK(!xs_is_ptr(&x) && xs_is(&x, "bNNa"));
+    /* matches do not overlap */
+    xs_replace_all(xs_new(&x, "aaaaa"), xs_new(&n, "aa"), xs_new(&r, "b"));
+    CHECK(xs_is(&x, "bba"));
+    /* the needle may be x itself */
+    xs_replace_all(&x, &x, xs_new(&r, "whole"));
+    CHECK(xs_is(&x, "whole"));
+    xs_free(&x);
+
+    /* a copy sharing the buffer keeps the old text on both paths */
+    xs_new(&x, "one two one two one two one two");
+    xs_cpy(&copy, &x);
+    xs_replace_all(&x, xs_new(&n, "one"), xs_new(&r, "ONE"));
+    CHECK(xs_is(&x, "ONE two ONE two ONE two ONE two"));
+    CHECK(xs_is(&copy, "one two one two one two one two"));
+    xs_replace_all(&copy, xs_new(&n, "two"), xs_new(&r, "2"));
+    CHECK(xs_is(&copy, "one 2 one 2 one 2 one 2"));
+    CHECK(xs_is(&x, "ONE two ONE two ONE two ONE two"));
+    xs_free(&copy);
+
+    /* epoch protection survives the rebuilt buffer */
+    xs_epoch_protect(&x);
+    xs_replace_all(&x, xs_new(&n, "two"), xs_new(&r, "three"));
+    CHECK(x.flag2 && xs_is(&x, "ONE three ONE three ONE three ONE three"));
+    xs_free(&x);
+    xs_epoch_reclaim();
+}
+
+static void check_replace_many(void)
+{
+    static const char *const html[] = {"&", "&amp;", "<", "&lt;", ">", "&gt;",
+                                       "<<", "[", "", "ignored"};
+    xs_replacer *t = xs_replacer_new(html, 5);
+    xs x, copy;
+
+    /* the empty pattern is dropped, the longest pattern wins */
+    CHECK(t->nrules == 4);
+    xs_replace_many(xs_newempty(&x), t);
+    CHECK(xs_is(&x, ""));
+    xs_replace_many(xs_new(&x, "plain"), t);
+    CHECK(xs_is(&x, "plain"));
+    xs_replace_many(xs_new(&x, "<<<a>"), t);
+    CHECK(xs_is(&x, "[&lt;a&gt;"));
+    /* growing past 15 bytes */
+    xs_replace_many(xs_new(&x, "a&b&c&d"), t);
+    CHECK(xs_is_ptr(&x) && xs_is(&x, "a&amp;b&amp;c&amp;d"));
+    xs_free(&x);
+
+    /* a copy sharing the buffer keeps the old text */
+    xs_new(&x, "x < y && y > z, for a heap string");
+    xs_cpy(&copy, &x);
+    xs_replace_many(&x, t);
+    CHECK(xs_is(&x, "x &lt; y &amp;&amp; y &gt; z, for a heap string"));
+    CHECK(xs_is(&copy, "x < y && y > z, for a heap string"));
+    xs_free(&copy);
+    xs_free(&x);
+    xs_replacer_free(t);
+}
+
+static void check_json(void)
+{
+    xs in, out, copy;
+    char all[128];
+
+    /* escaping appends and picks the short forms where JSON has them */
+    xs_json_escape_append(xs_new(&out, ">"), xs_newempty(&in));
+    CHECK(xs_is(&out, ">"));
+    xs_json_escape_append(&out, xs_new_len(&in, "a\"/\\\n\x01", 6));
+    CHECK(xs_is(&out, ">a\\\"/\\\\\\n\\u0001"));
+    xs_free(&out);
+
+    /* every ASCII byte survives the round trip, in place as well */
+    for (int i = 0; i < 128; i++)
+        all[i] = i;
+    xs_new_len(&in, all, sizeof(all));
+    xs_json_escape_append(xs_newempty(&out), &in);
+    CHECK(xs_json_unescape(&out, &out) && xs_size(&out) == sizeof(all) &&
+          !memcmp(xs_data(&out), all, sizeof(all)));
+    xs_free(&out);
+    xs_free(&in);
+
+    /* \u escapes, surrogate pairs included, become UTF-8 */
+    xs_new(&in, "\\u00e9\\u20ac\\ud83d\\ude00");
+    CHECK(xs_json_unescape(xs_newempty(&out), &in) &&
+          xs_is(&out, "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"));
+    xs_free(&in);
+    /* malformed escapes return NULL and leave out untouched */
+    static const char *const bad[] = {"\\", "\\x", "\\u12", "\\u12g4",
+                                      "\\udc00", "\\ud83dx", "\\ud83d\\u0041"};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(*bad); i++) {
+        CHECK(!xs_json_unescape(&out, xs_new(&in, bad[i])));
+        CHECK(xs_is(&out, "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"));
+    }
+    xs_free(&out);
+
+    /* unescaping a string that shares its buffer leaves the copy alone */
+    xs_new(&in, "tab\\there, long enough for the heap");
+    xs_cpy(&copy, &in);
+    CHECK(xs_json_unescape(&in, &in) &&
+          xs_is(&in, "tab\there, long enough for the heap"));
+    CHECK(xs_is(&copy, "tab\\there, long enough for the heap"));
+    xs_free(&copy);
+    xs_free(&in);
+}
+
+static xs_view view_of_cstr(const char *s)
+{
+    return (xs_view){s, strlen(s)};
+}
+
+static void check_base64_hex(void)
+{
+    /* RFC 4648 test vectors */
+    static const char *const plain[] = {"", "f", "fo", "foo", "foob", "fooba",
+                                        "foobar"};
+    static const char *const std[] = {"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==",
+                                      "Zm9vYmE=", "Zm9vYmFy"};
+    static const char *const url[] = {"", "Zg", "Zm8", "Zm9v", "Zm9vYg",
+                                      "Zm9vYmE", "Zm9vYmFy"};
+    xs out, back, copy;
+    unsigned char all[256];
+
+    for (size_t i = 0; i < sizeof(plain) / sizeof(*plain); i++) {
+        xs_base64_encode_append(xs_newempty(&out), view_of_cstr(plain[i]), false);
+        CHECK(xs_is(&out, std[i]));
+        xs_free(&out);
+        xs_base64_encode_append(xs_newempty(&out), view_of_cstr(plain[i]), true);
+        CHECK(xs_is(&out, url[i]));
+        xs_free(&out);
+        /* padding is optional when decoding */
+        CHECK(xs_base64_decode_append(xs_newempty(&out), view_of_cstr(std[i]),
+                                      false) &&
+              xs_is(&out, plain[i]));
+        xs_free(&out);
+        CHECK(xs_base64_decode_append(xs_newempty(&out), view_of_cstr(url[i]),
+                                      false) &&
+              xs_is(&out, plain[i]));
+        xs_free(&out);
+    }
+
+    /* every byte value, long enough for the vector loops, both alphabets */
+    for (int i = 0; i < 256; i++)
+        all[i] = 255 - i;
+    for (int u = 0; u < 2; u++) {
+        xs_base64_encode_append(xs_newempty(&out),
+                                (xs_view){(char *) all, sizeof(all)}, u);
+        CHECK(xs_base64_decode_append(xs_newempty(&back), xs_view_of(&out), u) &&
+              xs_size(&back) == sizeof(all) &&
+              !memcmp(xs_data(&back), all, sizeof(all)));
+        xs_free(&back);
+        xs_free(&out);
+    }
+    xs_hex_encode_append(xs_newempty(&out), (xs_view){(char *) all, sizeof(all)});
+    CHECK(!memcmp(xs_data(&out), "fffefdfc", 8) && xs_size(&out) == 512);
+    CHECK(xs_hex_decode_append(xs_newempty(&back), xs_view_of(&out)) &&
+          xs_size(&back) == sizeof(all) &&
+          !memcmp(xs_data(&back), all, sizeof(all)));
+    xs_free(&back);
+    xs_free(&out);
+
+    /* appending keeps what is there; malformed input leaves it unchanged */
+    xs_new(&out, "ab");
+    CHECK(xs_hex_decode_append(&out, view_of_cstr("4A4b")) && xs_is(&out, "abJK"));
+    CHECK(!xs_hex_decode_append(&out, view_of_cstr("4")));
+    CHECK(!xs_hex_decode_append(&out, view_of_cstr("4g")));
+    CHECK(!xs_base64_decode_append(&out, view_of_cstr("Z"), false));
+    CHECK(!xs_base64_decode_append(&out, view_of_cstr("Zg="), false));
+    CHECK(!xs_base64_decode_append(&out, view_of_cstr("Zg==="), false));
+    CHECK(!xs_base64_decode_append(&out, view_of_cstr("Zm9v!A=="), false));
+    CHECK(!xs_base64_decode_append(&out, view_of_cstr("Zm-_"), false));
+    CHECK(xs_is(&out, "abJK"));
+    xs_free(&out);
+
+    /* appending to a string whose buffer a copy shares */
+    xs_new(&out, "a string long enough for the heap");
+    xs_cpy(&copy, &out);
+    xs_hex_encode_append(&out, view_of_cstr("\x01"));
+    CHECK(xs_is(&out, "a string long enough for the heap01"));
+    CHECK(xs_is(&copy, "a string long enough for the heap"));
+    xs_free(&copy);
+    xs_free(&out);
+}
+
+static void check_url(void)
+{
+    xs x, copy;
+    char all[256];
+
+    xs_url_encode_append(xs_newempty(&x), view_of_cstr(""), false);
+    CHECK(xs_is(&x, ""));
+    xs_url_encode_append(&x, view_of_cstr("a b+c/\xc3\xa9~"), false);
+    CHECK(xs_is(&x, "a%20b%2Bc%2F%C3%A9~"));
+    xs_free(&x);
+    xs_url_encode_append(xs_newempty(&x), view_of_cstr("a b+c"), true);
+    CHECK(xs_is(&x, "a+b%2Bc"));
+
+    /* '+' is a space only in form encoding; bad escapes are kept */
+    xs_url_decode(&x, true);
+    CHECK(xs_is(&x, "a b+c"));
+    xs_url_decode(xs_new(&x, "a+b%2b"), false);
+    CHECK(xs_is(&x, "a+b+"));
+    xs_url_decode(xs_new(&x, "%41%4a%zz%4%"), false);
+    CHECK(xs_is(&x, "AJ%zz%4%"));
+    xs_url_decode(xs_newempty(&x), true);
+    CHECK(xs_is(&x, ""));
+
+    /* every byte value round trips in both modes */
+    for (int i = 0; i < 256; i++)
+        all[i] = i;
+    for (int plus = 0; plus < 2; plus++) {
+        xs_url_encode_append(xs_newempty(&x), (xs_view){all, sizeof(all)}, plus);
+        CHECK(xs_size(&x) == 66 + 3 * 190 - (plus ? 2 : 0));
+        xs_url_decode(&x, plus);
+        CHECK(xs_size(&x) == sizeof(all) && !memcmp(xs_data(&x), all, sizeof(all)));
+        xs_free(&x);
+    }
+
+    /* a shared buffer is left shared without escapes and detached with */
+    xs_new(&x, "no-escapes-in-this-heap-string");
+    xs_cpy(&copy, &x);
+    xs_url_decode(&x, true);
+    CHECK(x.ptr == copy.ptr);
+    xs_free(&x);
+    xs_new(&x, "one%20escape%20in-this-heap-string");
+    xs_free(&copy);
+    xs_cpy(&copy, &x);
+    xs_url_decode(&x, false);
+    CHECK(xs_is(&x, "one escape in-this-heap-string"));
+    CHECK(xs_is(&copy, "one%20escape%20in-this-heap-string"));
+    xs_free(&copy);
+    xs_free(&x);
+}
+
+static void check_count(void)
+{
+    static const char set[] = "a\x80\xff,";
+    char buf[1000];
+    uint64_t hist[256] = {0}, want[256] = {0};
+    size_t c = 0, any = 0;
+    uint32_t seed = 1;
+    xs x;
+
+    /* empty and inline strings, and an empty set */
+    xs_newempty(&x);
+    xs_byte_histogram(&x, hist);
+    CHECK(!xs_count_char(&x, 0) && !xs_count_any(&x, set));
+    xs_new(&x, "a,b,\xff,a");
+    CHECK(xs_count_char(&x, 'a') == 2 && xs_count_char(&x, '\xff') == 1);
+    CHECK(xs_count_any(&x, set) == 6 && !xs_count_any(&x, ""));
+
+    /* every byte value through the vector loops, against a plain count */
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+        c += buf[i] == '\x80';
+        any += buf[i] && strchr(set, buf[i]);
+        want[(uint8_t) buf[i]] += 2;
+    }
+    xs_new_len(&x, buf, sizeof(buf));
+    CHECK(xs_count_char(&x, '\x80') == c && xs_count_any(&x, set) == any);
+    /* the histogram adds to what is there */
+    xs_byte_histogram(&x, hist);
+    xs_byte_histogram(&x, hist);
+    CHECK(!memcmp(hist, want, sizeof(hist)));
+    xs_free(&x);
+}
+
+static void check_csv(void)
+{
+    xs_csv_parser p;
+    xs_view f[4];
+    xs out, copy;
+    char big[200];
+
+    xs_csv_init(&p, "", 0, ',');
+    CHECK(xs_csv_next(&p, f, 4) == 0);
+
+    /* quoted delimiters and newlines, "" escapes, empty fields, CRLF and a
+     * last record without a line ending
+     */
+    static const char doc[] = "a,\"b,\"\"c\"\"\",,\"\"\r\n\"x\ny\"\nlast,one";
+    xs_csv_init(&p, doc, sizeof(doc) - 1, ',');
+    CHECK(xs_csv_next(&p, f, 4) == 4 && view_is(f[0], "a") &&
+          view_is(f[1], "b,\"\"c\"\"") && view_is(f[2], "") &&
+          view_is(f[3], ""));
+    xs_csv_unescape(xs_newempty(&out), f[1]);
+    CHECK(xs_is(&out, "b,\"c\""));
+    /* fields past max are counted but not stored */
+    CHECK(xs_csv_next(&p, f, 0) == 1);
+    CHECK(xs_csv_next(&p, f, 4) == 2 && view_is(f[0], "last") &&
+          view_is(f[1], "one"));
+    CHECK(xs_csv_next(&p, f, 4) == 0);
+
+    /* a quoted region that spans a 64-byte block boundary, tab-separated */
+    memset(big, 'q', sizeof(big));
+    big[0] = '"';
+    big[60] = '\t';
+    big[150] = '"';
+    big[151] = '\t';
+    xs_csv_init(&p, big, 160, '\t');
+    CHECK(xs_csv_next(&p, f, 4) == 2 && f[0].len == 149 && f[1].len == 8);
+
+    /* unescaping a view into out itself, heap and shared */
+    xs_new(&out, "\"\"quoted\"\" text long enough for the heap");
+    xs_cpy(&copy, &out);
+    xs_csv_unescape(&out, xs_view_of(&out));
+    CHECK(xs_is(&out, "\"quoted\" text long enough for the heap"));
+    CHECK(xs_is(&copy, "\"\"quoted\"\" text long enough for the heap"));
+    xs_csv_unescape(&copy, xs_view_of(&copy));
+    CHECK(xs_is(&copy, "\"quoted\" text long enough for the heap"));
+    xs_csv_unescape(&out, (xs_view){xs_data(&out) + 1, 6});
+    CHECK(xs_is(&out, "quoted"));
+    xs_free(&copy);
+    xs_free(&out);
+}
+
+static void check_par_nested(void *arg, size_t i)
+{
+    ((int *) arg)[i]++;
+}
+
+static void check_par_task(void *arg, size_t i)
+{
+    int *seen = arg;
+    __atomic_fetch_add(&seen[i], 1, __ATOMIC_RELAXED);
+    if (i == 0) /* a nested job runs serially on this thread */
+        xs_par_run(4, 4, check_par_nested, seen + 1000);
+}
+
+static void check_par_cut(void *arg, size_t i, const char *p, size_t len)
+{
+    (void) i;
+    bool *ok = arg;
+    if (len && p[len - 1] != '\n' && p[len] != 0)
+        *ok = false;
+}
+
+static void check_par(void)
+{
+    static int seen[1004];
+    size_t *pos;
+    bool cuts_ok = true;
+    xs x, needle;
+
+    xs_par_run(1000, 4, check_par_task, seen);
+    for (int i = 0; i < 1004; i++)
+        CHECK(seen[i] == 1);
+    xs_par_shutdown();
+
+    /* cuts fall just past a delimiter, or the chunk ends the string */
+    xs_new(&x, "one\ntwo\nthree\nfour\nfive\nsix\nseven\neight\n");
+    CHECK(xs_par_chunked(&x, 3, '\n', 4, check_par_cut, &cuts_ok) == 8);
+    CHECK(cuts_ok);
+    CHECK(xs_par_count_char(&x, '\n', 4) == 8);
+    CHECK(xs_par_line_index(&x, &pos, 4) == 8 && pos[0] == 4 && pos[7] == 40);
+    free(pos);
+    CHECK(xs_par_utf8_valid(&x, 4));
+    xs_free(&x);
+
+    /* empty input */
+    xs_newempty(&x);
+    CHECK(xs_par_count_char(&x, 'a', 4) == 0 && xs_par_utf8_valid(&x, 4));
+    CHECK(xs_par_line_index(&x, &pos, 4) == 0);
+    free(pos);
+    CHECK(xs_par_find_all(&x, xs_new(&needle, "a"), &pos, 4) == 0);
+    free(pos);
+
+    /* overlapping matches, and an empty needle finds nothing */
+    xs_new(&x, "aaaa");
+    CHECK(xs_par_find_all(&x, xs_new(&needle, "aa"), &pos, 4) == 3 &&
+          pos[0] == 0 && pos[2] == 2);
+    free(pos);
+    CHECK(xs_par_find_all(&x, xs_newempty(&needle), &pos, 4) == 0);
+    free(pos);
+
+    /* more than one 4 MiB chunk: a match across a cut, and malformed UTF-8
+     * only in the last chunk
+     */
+    size_t big = (size_t) 9 << 20, cut = (size_t) 1 << 22;
+    char *buf = malloc(xs_alloc_size(big));
+    memset(buf, 'x', big);
+    memcpy(buf + cut - 1, "abc", 3);
+    memcpy(buf + big - 8, "\xc3\xa9\xe2\x82\xac", 5);
+    xs_new_adopt(&x, buf, big, xs_alloc_size(big));
+    CHECK(xs_par_find_all(&x, xs_new(&needle, "abc"), &pos, 4) == 1 &&
+          pos[0] == cut - 1);
+    free(pos);
+    CHECK(xs_par_count_char(&x, 'x', 4) == big - 8);
+    CHECK(xs_par_utf8_valid(&x, 4));
+    xs_data(&x)[big - 2] = '\xc0';
+    CHECK(!xs_par_utf8_valid(&x, 4));
+    memcpy(xs_data(&x) + big - 3, "\xed\xa0\x80", 3);
+    CHECK(!xs_par_utf8_valid(&x, 4));
+    xs_free(&x);
+}
+
+static void check_batch(void)
+{
+    static xs arr[1000];
+    xs outside;
+
+    /* copies share buffers within the array and with a string outside it */
+    xs_new(&outside, "A Shared String, Long Enough For The Heap");
+    for (size_t i = 0; i < 1000; i++) {
+        if (i % 3 == 0)
+            xs_cpy(&arr[i], &outside);
+        else if (i % 3 == 1)
+            xs_new(&arr[i], i % 2 ? "  Padded Heap String With Capitals  "
+                                  : " Short ");
+        else
+            xs_cpy(&arr[i], &arr[i - 1]);
+    }
+    xs_batch_apply(arr, 1000, xs_batch_op_tolower, NULL, 4);
+    xs_batch_apply(arr, 1000, xs_batch_op_trim, " ", 4);
+    for (size_t i = 0; i < 1000; i++) {
+        size_t made = i % 3 == 2 ? i - 1 : i; /* where the text came from */
+        const char *want = made % 3 == 0 ? "a shared string, long enough for the heap"
+                           : made % 2    ? "padded heap string with capitals"
+                                         : "short";
+        CHECK(xs_is(&arr[i], want));
+        xs_free(&arr[i]);
+    }
+    CHECK(xs_is(&outside, "A Shared String, Long Enough For The Heap"));
+    xs_free(&outside);
+
+    /* empty array */
+    xs_batch_apply(arr, 0, xs_batch_op_tolower, NULL, 4);
+}
+
+static void check_map(void)
+{
+    static xs keys[600];
+    static size_t found[600];
+    static uint64_t hashes[600];
+    static bool same[600];
+    char text[64];
+    xs_map m;
+    xs key, small;
+
+    /* equal contents hash and compare equal, inline or on the heap */
+    xs_new(&key, "short, but moved to the heap");
+    xs_truncate(&key, 5);
+    CHECK(xs_is_ptr(&key) && xs_equal(&key, xs_new(&small, "short")));
+    CHECK(xs_hash(&key) == xs_hash(&small));
+    xs_free(&key);
+    CHECK(xs_hash(xs_newempty(&small)) != xs_hash(xs_new_len(&key, "", 1)));
+
+    /* keys straddle the inline/heap boundary and the empty key is one */
+    xs_map_init(&m);
+    for (int i = 0; i < 600; i++) {
+        int len = snprintf(text, sizeof(text), "%0*d", i % 40, i);
+        xs_new_len(&keys[i], text, i ? len : 0);
+        xs_cpy(&key, &keys[i]);
+        CHECK(xs_map_insert(&m, &key) == (size_t) i);
+    }
+    CHECK(m.nkeys == 600);
+    /* a key already present stays with the caller */
+    snprintf(text, sizeof(text), "%039d", 39);
+    xs_new(&key, text);
+    CHECK(xs_map_insert(&m, &key) == 39 && xs_is(&key, text));
+    xs_free(&key);
+
+    xs_map_find_batch(&m, keys, 600, found);
+    xs_hash_batch(keys, 600, hashes);
+    xs_equal_batch(keys, m.keys, 600, same);
+    for (size_t i = 0; i < 600; i++) {
+        CHECK(found[i] == i && xs_map_find(&m, &keys[i]) == i);
+        CHECK(hashes[i] == xs_hash(&keys[i]) && same[i]);
+    }
+    xs_new(&key, "not a key");
+    CHECK(xs_map_find(&m, &key) == XS_MAP_NOTFOUND);
+    xs_map_find_batch(&m, &key, 1, found);
+    CHECK(found[0] == XS_MAP_NOTFOUND);
+    xs_map_find_batch(&m, keys, 0, found);
+    for (int i = 0; i < 600; i++)
+        xs_free(&keys[i]);
+    xs_map_free(&m);
+}
+
+static void check_find_equal(void)
+{
+    xs c[6], probe;
+
+    /* around the 15-byte limit, and "abc" with stale bytes after it */
+    xs_new(&c[0], "0123456789abcdef");
+    xs_new(&c[1], "0123456789abcdX");
+    xs_truncate(xs_new(&c[2], "abcdefgh"), 3);
+    xs_new(&c[3], "0123456789abcde");
+    xs_truncate(xs_new(&c[4], "heap string cut down to xyz"), 3);
+    xs_newempty(&c[5]);
+
+    CHECK(xs_find_equal(xs_new(&probe, "abc"), c, 6) == 2);
+    CHECK(xs_find_equal(xs_new(&probe, "0123456789abcde"), c, 6) == 3);
+    /* heap candidates holding short strings are compared by content */
+    CHECK(xs_find_equal(xs_new(&probe, "hea"), c, 6) == 4);
+    CHECK(xs_find_equal(xs_newempty(&probe), c, 6) == 5);
+    CHECK(xs_find_equal(xs_new(&probe, "ab"), c, 6) == 6);
+    CHECK(xs_find_equal(&probe, c, 0) == 0);
+    memcpy(xs_data(&c[4]), "abc", 3);
+    CHECK(xs_find_equal(xs_new(&probe, "abc"), c + 3, 3) == 1);
+    /* a heap probe */
+    xs_new(&probe, "0123456789abcdef");
+    CHECK(xs_find_equal(&probe, c, 6) == 0 && xs_find_equal(&probe, c + 1, 5) == 5);
+    xs_free(&probe);
+    for (int i = 0; i < 6; i++)
+        xs_free(&c[i]);
+}
+
+static void check_ngram(void)
+{
+    static xs docs[200];
+    static size_t ids[200];
+    static const char *const needles[] = {"", "a", "ab", "abc", "bca", "cab",
+                                          "aaaa", "abcabc", "zzz", "cbacba"};
+    xs_ngram_index idx;
+    xs needle;
+    char text[40];
+    uint32_t seed = 7;
+
+    /* short and empty documents have no trigrams but still match */
+    xs_ngram_init(&idx);
+    for (size_t i = 0; i < 200; i++) {
+        size_t len = i % 37;
+        for (size_t k = 0; k < len; k++) {
+            seed = seed * 1103515245 + 12345;
+            text[k] = "abc"[(seed >> 16) % 3];
+        }
+        xs_new_len(&docs[i], text, len);
+        CHECK(xs_ngram_add(&idx, &docs[i]) == i);
+    }
+
+    /* every needle against a plain scan of all documents */
+    for (size_t q = 0; q < sizeof(needles) / sizeof(*needles); q++) {
+        xs_new(&needle, needles[q]);
+        size_t want = 0, n = xs_ngram_search(&idx, &needle, ids, 200);
+        bool same = true;
+        for (size_t i = 0; i < 200; i++)
+            if (xs_find(&docs[i], &needle))
+                same &= want < n && ids[want++] == i;
+        CHECK(same && n == want);
+        /* max only limits what is stored */
+        CHECK(xs_ngram_search(&idx, &needle, ids, 1) == want);
+        xs_free(&needle);
+    }
+    xs_ngram_free(&idx);
+    for (size_t i = 0; i < 200; i++)
+        xs_free(&docs[i]);
+}
+
+/* chunk boundaries of x as the hashes of the chunks, for comparing */
+static size_t cdc_hashes(const xs *x, uint64_t *out, bool *sizes_ok)
+{
+    xs_cdc c;
+    xs_view v;
+    xs tmp;
+    size_t n = 0, total = 0;
+
+    xs_cdc_init(&c, x, 256, 1024, 4096);
+    while (xs_cdc_next(&c, &v)) {
+        *sizes_ok &= v.len <= 4096 && (v.len >= 256 || total + v.len == xs_size(x));
+        CHECK(v.ptr == xs_data(x) + total);
+        total += v.len;
+        out[n++] = xs_hash(xs_new_len(&tmp, v.ptr, v.len));
+        xs_free(&tmp);
+    }
+    CHECK(total == xs_size(x));
+    return n;
+}
+
+static void check_rolling(void)
+{
+    static char buf[(1 << 16) + 1];
+    static uint64_t before[1024], after[1024];
+    xs x, win;
+    xs_rolling r, one;
+    uint64_t h, h1;
+    size_t off, off1, count = 0;
+    uint32_t seed = 3;
+
+    /* every window hashes like the same bytes on their own */
+    xs_new(&x, "abcabcabcabcXabcabcabcabc");
+    xs_rolling_init(&r, &x, 6);
+    while (xs_rolling_next(&r, &h, &off)) {
+        xs_rolling_init(&one, xs_new_len(&win, xs_data(&x) + off, 6), 6);
+        CHECK(xs_rolling_next(&one, &h1, &off1) && h == h1 && off1 == 0);
+        CHECK(!xs_rolling_next(&one, &h1, &off1));
+        xs_free(&win);
+        count++;
+    }
+    CHECK(count == xs_size(&x) - 5);
+    xs_free(&x);
+
+    /* a window longer than the string gives none, 0 is taken as 1 */
+    xs_rolling_init(&r, xs_new(&x, "abc"), 4);
+    CHECK(!xs_rolling_next(&r, &h, &off));
+    xs_rolling_init(&r, &x, 0);
+    for (count = 0; xs_rolling_next(&r, &h, &off); count++)
+        ;
+    CHECK(count == 3);
+
+    /* chunks tile the input within the size limits; an insertion near the
+     * start leaves the later boundaries where they were
+     */
+    bool sizes_ok = true;
+    xs_cdc c;
+    xs_view v;
+    xs_cdc_init(&c, xs_newempty(&x), 256, 1024, 4096);
+    CHECK(!xs_cdc_next(&c, &v));
+    CHECK(cdc_hashes(xs_new(&x, "below min"), before, &sizes_ok) == 1);
+    for (size_t i = 0; i < sizeof(buf) - 1; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+    xs_new_len(&x, buf, sizeof(buf) - 1);
+    size_t nb = cdc_hashes(&x, before, &sizes_ok);
+    xs_free(&x);
+    memmove(buf + 101, buf + 100, sizeof(buf) - 101);
+    buf[100] = '+';
+    xs_new_len(&x, buf, sizeof(buf));
+    size_t na = cdc_hashes(&x, after, &sizes_ok), shared = 0;
+    xs_free(&x);
+    CHECK(sizes_ok && nb > 16);
+    for (size_t i = 0; i < na; i++)
+        for (size_t k = 0; k < nb; k++)
+            if (after[i] == before[k]) {
+                shared++;
+                break;
+            }
+    CHECK(shared + 2 >= nb);
+}
+
+/* memcmp over the shorter key, then the shorter key first */
+static int collate_cmp(const xs *a, const xs *b)
+{
+    size_t la = xs_size(a), lb = xs_size(b);
+    int c = memcmp(xs_data(a), xs_data(b), la < lb ? la : lb);
+    return c ? c : (la > lb) - (la < lb);
+}
+
+static void check_collate(void)
+{
+    char big[2][320];
+    const char *sorted[] = {"", "\0", "\0a", "\1", big[0], big[1], "a",
+                            "file.txt", "file1", "file01", "file001", "file2",
+                            "file9", "file10", "file10a", "file100", "x"};
+    size_t n = sizeof(sorted) / sizeof(*sorted);
+    xs keys[sizeof(sorted) / sizeof(*sorted)];
+
+    /* a 254-digit and a 300-digit number, on both sides of the 255 escape */
+    memset(big[0], '9', 254);
+    big[0][254] = 0;
+    memset(big[1], '1', 300);
+    big[1][300] = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t len = i == 1 || i == 2 ? i : strlen(sorted[i]);
+        xs_collate_key_append(xs_newempty(&keys[i]), (xs_view){sorted[i], len});
+    }
+    for (size_t i = 0; i + 1 < n; i++)
+        CHECK(collate_cmp(&keys[i], &keys[i + 1]) < 0);
+
+    /* exact sizes: an escaped byte takes 2, a run '0', its length, digits
+     * and one tie-break byte, a run of 255 digits or more 8 length bytes
+     */
+    CHECK(xs_size(&keys[0]) == 1 && xs_size(&keys[2]) == 4);
+    CHECK(xs_size(&keys[9]) == 4 + 3 + 1 + 1);
+    CHECK(xs_size(&keys[4]) == 2 + 254 + 1 + 1);
+    CHECK(xs_size(&keys[5]) == 10 + 300 + 1 + 1);
+    CHECK(xs_collate_prefix(xs_view_of(&keys[8])) ==
+          xs_collate_prefix(xs_view_of(&keys[9])));
+    for (size_t i = 0; i < n; i++)
+        xs_free(&keys[i]);
+
+    /* appending keeps what is in out */
+    xs_new(&keys[0], "k:");
+    xs_collate_key_append(&keys[0], (xs_view){"a7", 2});
+    CHECK(xs_size(&keys[0]) == 2 + 1 + 3 + 1 + 1 &&
+          !memcmp(xs_data(&keys[0]), "k:a0\0017\0\0", 8));
+    xs_free(&keys[0]);
+}
+
+static void check_repeat_pad(void)
+{
+    xs x, copy;
+
+    /* repeat: 0 and 1 times, empty input, the memset path, past 15 bytes */
+    CHECK(xs_repeat(xs_new(&x, "ab"), 1) && xs_is(&x, "ab"));
+    CHECK(xs_repeat(&x, 7) && !xs_is_ptr(&x) && xs_is(&x, "ababababababab"));
+    CHECK(xs_repeat(xs_new(&x, "ab"), 8) && xs_is_ptr(&x) &&
+          xs_is(&x, "abababababababab"));
+    CHECK(xs_repeat(&x, 0) && xs_is(&x, ""));
+    xs_free(&x);
+    CHECK(xs_repeat(xs_newempty(&x), 1000) && xs_is(&x, ""));
+    CHECK(xs_repeat(xs_new(&x, "-"), 20) && xs_is(&x, "--------------------"));
+    xs_free(&x);
+    CHECK(xs_repeat(xs_new(&x, "abc"), 3) && xs_is(&x, "abcabcabc"));
+    /* sizes past 2^54 are refused and leave x alone */
+    CHECK(!xs_repeat(&x, (size_t) -1) && !xs_repeat(&x, (size_t) 1 << 53));
+    CHECK(xs_is(&x, "abcabcabc"));
+
+    /* pad: each side, the odd byte on the right, no-op when wide enough */
+    CHECK(xs_is(xs_pad_left(&x, 12, '<'), "<<<abcabcabc"));
+    CHECK(xs_is(xs_pad_right(&x, 14, '>'), "<<<abcabcabc>>"));
+    CHECK(xs_is(xs_pad_center(&x, 17, '|'), "|<<<abcabcabc>>||"));
+    CHECK(xs_is(xs_pad_center(&x, 3, '?'), "|<<<abcabcabc>>||"));
+    xs_free(&x);
+    CHECK(xs_is(xs_pad_center(xs_newempty(&x), 3, '.'), "..."));
+
+    /* fill drops the old contents, inline or heap */
+    CHECK(xs_is(xs_fill(&x, 'z', 0), ""));
+    CHECK(xs_is_ptr(xs_fill(&x, 'z', 20)) && xs_is(&x, "zzzzzzzzzzzzzzzzzzzz"));
+    CHECK(xs_is(xs_fill(&x, 'y', 2), "yy"));
+    xs_free(&x);
+
+    /* copies sharing the buffer keep the old text */
+    xs_new(&x, "a string long enough for the heap");
+    xs_cpy(&copy, &x);
+    xs_repeat(&x, 2);
+    xs_pad_left(&copy, 40, ' ');
+    CHECK(xs_size(&x) == 66 && xs_is(&copy, "       a string long enough for the heap"));
+    xs_free(&x);
+    xs_cpy(&x, &copy);
+    xs_fill(&x, '#', 3);
+    CHECK(xs_is(&x, "###") && xs_size(&copy) == 40);
+    xs_free(&x);
+
+    /* epoch protection stays on through repeat, pad and fill */
+    xs_epoch_protect(&copy);
+    xs_repeat(&copy, 2);
+    xs_pad_right(&copy, 100, '.');
+    CHECK(copy.flag2 && xs_size(&copy) == 100);
+    xs_fill(&copy, '!', 50);
+    CHECK(copy.flag2 && xs_size(&copy) == 50);
+    xs_free(&copy);
+    xs_epoch_reclaim();
+}
+
+static void check_casefold(void)
+{
+    xs x, copy;
+
+    /* ASCII, also past the vector scan, and the empty string */
+    CHECK(xs_is(xs_casefold(xs_new(&x, "HeLLo, World")), "hello, world"));
+    xs_free(&x);
+    CHECK(xs_is(xs_casefold(xs_newempty(&x)), ""));
+    xs_new(&x, "ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJ\xc3\x89");
+    CHECK(xs_is(xs_casefold(&x), "abcdefghijklmnopqrstuvwxyzabcdefghij\xc3\xa9"));
+    xs_free(&x);
+
+    /* final and plain sigma fold alike, and Cherokee folds to upper case */
+    CHECK(xs_is(xs_casefold(xs_new(&x, "\xce\xa3\xce\x91\xcf\x82")),
+                "\xcf\x83\xce\xb1\xcf\x83"));
+    xs_free(&x);
+    CHECK(xs_is(xs_casefold(xs_new(&x, "\xea\xad\xb0\xe1\x8f\xb8")),
+                "\xe1\x8e\xa0\xe1\x8f\xb0"));
+    xs_free(&x);
+
+    /* encoded lengths change: capital sharp s, Kelvin sign, A with stroke */
+    CHECK(xs_is(xs_casefold(xs_new(&x, "\xe1\xba\x9e\xe2\x84\xaa")), "\xc3\x9fk"));
+    xs_free(&x);
+    CHECK(xs_is(xs_casefold(xs_new(&x, "\xc8\xba\xc8\xba\xc8\xba")),
+                "\xe2\xb1\xa5\xe2\xb1\xa5\xe2\xb1\xa5"));
+    xs_free(&x);
+    CHECK(xs_is(xs_casefold(xs_new(&x, "\xf0\x90\x90\x80")), "\xf0\x90\x90\xa8"));
+    xs_free(&x);
+
+    /* malformed bytes are kept, the text around them still folds */
+    CHECK(xs_is(xs_casefold(xs_new(&x, "\xff" "A\xc3")), "\xff" "a\xc3"));
+    xs_free(&x);
+
+    /* a shared buffer keeps the old text, epoch protection stays on */
+    xs_new(&x, "\xc3\x84 string long enough for the heap");
+    xs_cpy(&copy, &x);
+    xs_epoch_protect(&x);
+    CHECK(xs_is(xs_casefold(&x), "\xc3\xa4 string long enough for the heap"));
+    CHECK(x.flag2 && xs_is(&copy, "\xc3\x84 string long enough for the heap"));
+    xs_free(&x);
+    xs_free(&copy);
+    xs_epoch_reclaim();
+
+    /* trim: each White_Space range edge, non-space neighbours kept */
+    xs_new(&x, "\xc2\xa0\xe3\x80\x80 \xe2\x80\x8a" "a b\xe2\x80\xa9\n\xc2\x85");
+    CHECK(xs_is(xs_trim_unicode(&x), "a b"));
+    xs_free(&x);
+    xs_new(&x, "\xe2\x80\x8b" "a\xe2\x80\x8b");
+    CHECK(xs_is(xs_trim_unicode(&x), "\xe2\x80\x8b" "a\xe2\x80\x8b"));
+    xs_free(&x);
+    CHECK(xs_is(xs_trim_unicode(xs_new(&x, " \xe1\x9a\x80\t")), ""));
+    xs_free(&x);
+    /* a stray continuation byte is not a space */
+    CHECK(xs_is(xs_trim_unicode(xs_new(&x, " a\xa0 ")), "a\xa0"));
+    xs_free(&x);
+}
+
+int main()
+{
+#ifdef XS_BENCH
+    bench_new_batch();
+    bench_map_find_batch();
+    return 0;
+#endif
+
+    /* Testing xs_strtok */
+    xs str = *xs_new(&str,"asd:aee:gdw:tfv:ddd");
+    char *pch = strtok(xs_data(&str) ,":");
+    while (pch != NULL)
+    {
+        printf ("%s ",pch);
+        pch = strtok (NULL, ":");
+    }
+    printf("\n");
+
+    printf("mpsc %s, epoch %s, deferred free %s\n",
+           smoke_mpsc_check() ? "ok" : "FAILED",
+           smoke_epoch_check() ? "ok" : "FAILED",
+           smoke_defer_check() ? "ok" : "FAILED");
+
+    check_gap();
+    check_piece();
+    check_replace_all();
+    check_replace_many();
+    check_json();
+    check_base64_hex();
+    check_url();
+    check_count();
+    check_csv();
+    check_par();
+    check_batch();
+    check_map();
+    check_find_equal();
+    check_ngram();
+    check_rolling();
+    check_collate();
+    check_repeat_pad();
+    check_casefold();
+    printf("checks %s\n", check_failures ? "FAILED" : "ok");
+
+    //xs string = *xs_tmp("\n foobarbar \n\n\n");
+    //xs_trim(&string, "\n ");
+    /*xs prefix = *xs_tmp("((((((("), suffix = *xs_tmp("))))))))))))");
+    xs string = *xs_new(&string,"aoaoaoaofoobarbar");
+    xs_concat(&string, &prefix, &suffix);
+    xs string_cpy = *xs_cpy(&xs_literal_empty(),&string);
+    xs_trim(&string_cpy,"(");*/
+    //xs hihi = *xs_cpy(&xs_literal_empty(),&string);
+    //xs qq = *xs_cpy(&xs_literal_empty(),&hihi);
+
+    //xs_concat(&string_cpy, &prefix, &suffix);
+    //printf("[%s] : %2zu\n", xs_data(&string_cpy), xs_size(&string_cpy));
+    //printf("[%s] : %2zu\n", xs_data(&string), xs_size(&string));
+    //printf("%d\n",*string.refcnt);
+    //printf("[%s] : %2zu\n", xs_data(&string), xs_size(&string));
+    /*xs string = *xs_tmp("\n foobarbar \n\n\n");
+    xs_trim(&string, "\n ");
+    printf("[%s] : %2zu\n", xs_data(&string), xs_size(&string));
+    */
+    /*xs prefix = *xs_tmp("((("), suffix = *xs_tmp(")))");
+    xs_concat(&string, &prefix, &suffix);
+    printf("[%s] : %2zu\n", xs_data(&string), xs_size(&string));
+    */
+    return check_failures != 0;
 }
\ No newline at end of file